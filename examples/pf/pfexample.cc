@@ -10,11 +10,6 @@ using namespace std;
 cv_obs * y;
 long load_data(char const * szName, cv_obs** y);
 
-double integrand_mean_x(const cv_state&, void*);
-double integrand_mean_y(const cv_state&, void*);
-double integrand_var_x(const cv_state&, void*);
-double integrand_var_y(const cv_state&, void*);
-
 int main(int argc, char** argv)
 {
     long lNumber = 1000;
@@ -35,13 +30,11 @@ int main(int argc, char** argv)
         for(int n = 1 ; n < lIterates ; ++n) {
             Sampler.Iterate();
 
-            double xm, xv, ym, yv;
-            xm = Sampler.Integrate(integrand_mean_x, NULL);
-            xv = Sampler.Integrate(integrand_var_x, (void*)&xm);
-            ym = Sampler.Integrate(integrand_mean_y, NULL);
-            yv = Sampler.Integrate(integrand_var_y, (void*)&ym);
+            //The means and variances of both coordinates are obtained in a single pass
+            double dMean[2], dVar[2];
+            Sampler.IntegrateMoments(2, [](const cv_state & s, double* d) { d[0] = s.x_pos; d[1] = s.y_pos; }, dMean, dVar);
 
-            cout << xm << "," << ym << "," << xv << "," << yv << endl;
+            cout << dMean[0] << "," << dMean[1] << "," << dVar[0] << "," << dVar[1] << endl;
         }
     }
 
@@ -73,27 +66,3 @@ long load_data(char const * szName, cv_obs** yp)
 
     return lIterates;
 }
-
-double integrand_mean_x(const cv_state& s, void *)
-{
-    return s.x_pos;
-}
-
-double integrand_var_x(const cv_state& s, void* vmx)
-{
-    double* dmx = (double*)vmx;
-    double d = (s.x_pos - (*dmx));
-    return d * d;
-}
-
-double integrand_mean_y(const cv_state& s, void *)
-{
-    return s.y_pos;
-}
-
-double integrand_var_y(const cv_state& s, void* vmy)
-{
-    double* dmy = (double*)vmy;
-    double d = (s.y_pos - (*dmy));
-    return d * d;
-}
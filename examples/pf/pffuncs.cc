@@ -48,11 +48,15 @@ smc::particle<cv_state> fInitialise(smc::rng *pRng)
 void fMove(long lTime, smc::particle<cv_state > & pFrom, smc::rng *pRng)
 {
     cv_state * cv_to = pFrom.GetValuePointer();
+    double dNoise[4];
 
-    cv_to->x_pos += cv_to->x_vel * Delta + pRng->Normal(0, sqrt(var_s));
-    cv_to->x_vel += pRng->Normal(0, sqrt(var_u));
-    cv_to->y_pos += cv_to->y_vel * Delta + pRng->Normal(0, sqrt(var_s));
-    cv_to->y_vel += pRng->Normal(0, sqrt(var_u));
+    //Draw all four innovations with one call.
+    pRng->NormalBatch(dNoise, 4, 0, 1);
+
+    cv_to->x_pos += cv_to->x_vel * Delta + sqrt(var_s) * dNoise[0];
+    cv_to->x_vel += sqrt(var_u) * dNoise[1];
+    cv_to->y_pos += cv_to->y_vel * Delta + sqrt(var_s) * dNoise[2];
+    cv_to->y_vel += sqrt(var_u) * dNoise[3];
 
     pFrom.AddToLogWeight(logLikelihood(lTime, *cv_to));
 }
@@ -33,16 +33,18 @@ int main(int argc, char** argv)
         moves.push_back(fMove2);
         smc::moveset<mChain<double> > Moveset(fInitialise, fSelect, moves, selector);
         Moveset.SetNumberOfMCMCMoves(1);
-        smc::sampler<mChain<double> > Sampler(lNumber, SMC_HISTORY_RAM);
+        smc::sampler<mChain<double> > Sampler(lNumber, SMC_HISTORY_NONE);
 
         Sampler.SetResampleParams(SMC_RESAMPLE_STRATIFIED, 0.5);
         Sampler.SetMoveSet(Moveset);
+        ///The path sampling integral is accumulated as the sampler runs, so no history need be stored
+        long lPathSampling = Sampler.AddPathSampling(pIntegrandPS, pWidthPS, NULL);
 
         Sampler.Initialise();
         Sampler.IterateUntil(lIterates);
 
         ///Estimate the normalising constant of the terminal distribution
-        double zEstimate = Sampler.IntegratePathSampling(pIntegrandPS, pWidthPS, NULL) - log(2.0);
+        double zEstimate = Sampler.GetPathSampling(lPathSampling) - log(2.0);
         ///Estimate the weighting factor for the terminal distribution
         double wEstimate = Sampler.Integrate(pIntegrandFS, NULL);
 
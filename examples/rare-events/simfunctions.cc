@@ -1,5 +1,6 @@
 #include <iostream>
 #include <cmath>
+#include <vector>
 #include <gsl/gsl_randist.h>
 
 #include "smctc.hh"
@@ -59,10 +60,12 @@ long fSelect(long lTime, const smc::particle<mChain<double> > & p, smc::rng *pRn
 void fMove1(long lTime, smc::particle<mChain<double> > & pFrom, smc::rng *pRng)
 {
     // The distance between points in the random grid.
-    static double delta = 0.025;
-    static double gridweight[2 * GRIDSIZE + 1], gridws = 0;
-    static mChain<double> NewPos[2 * GRIDSIZE + 1];
-    static mChain<double> OldPos[2 * GRIDSIZE + 1];
+    const double delta = 0.025;
+    // The grids are scratch storage, taken from the arena of the calling thread.
+    std::vector<double, smc::arena_allocator<double> > gridweight(2 * GRIDSIZE + 1);
+    std::vector<mChain<double>, smc::arena_allocator<mChain<double> > > NewPos(2 * GRIDSIZE + 1);
+    std::vector<mChain<double>, smc::arena_allocator<mChain<double> > > OldPos(2 * GRIDSIZE + 1);
+    double gridws = 0;
 
     // First select a new position from a grid centred on the old position, weighting the possible choises by the
     // posterior probability of the resulting states.
@@ -100,11 +103,6 @@ void fMove1(long lTime, smc::particle<mChain<double> > & pFrom, smc::rng *pRng)
 
     pFrom.SetLogWeight(pFrom.GetLogWeight() + logInc);
 
-    for(int i = 0; i < 2 * GRIDSIZE + 1; i++) {
-        NewPos[i].Empty();
-        OldPos[i].Empty();
-    }
-
     return;
 }
 ///Another move function
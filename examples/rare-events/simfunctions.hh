@@ -1,7 +1,37 @@
+#include <cstring>
+#include <vector>
+
 #include "smctc.hh"
 
 #include "markovchains/markovchain.h"
 
+//The chains are linked lists which are expensive to copy, so resampled particles share them until they are moved.
+namespace smc {
+template <> struct shared_values<mChain<double> > : std::true_type {};
+
+//A chain is stored, with SMC_HISTORY_DISK, as its length followed by its elements.
+template <> struct serialiser<mChain<double> > {
+    static void Write(const mChain<double> & sValue, std::vector<char> & Bytes)
+    {
+        long lLength = sValue.GetLength();
+        Bytes.insert(Bytes.end(), reinterpret_cast<const char*>(&lLength), reinterpret_cast<const char*>(&lLength + 1));
+        for(const mElement<double>* pElement = sValue.GetElement(0); lLength > 0 && pElement; pElement = pElement->pNext)
+            Bytes.insert(Bytes.end(), reinterpret_cast<const char*>(&pElement->value), reinterpret_cast<const char*>(&pElement->value + 1));
+    }
+    static void Read(const char* pBytes, size_t, mChain<double> & sValue)
+    {
+        long lLength;
+        std::memcpy(&lLength, pBytes, sizeof(long));
+        sValue.Empty();
+        for(long i = 0; i < lLength; i++) {
+            double dElement;
+            std::memcpy(&dElement, pBytes + sizeof(long) + i * sizeof(double), sizeof(double));
+            sValue.AppendElement(dElement);
+        }
+    }
+};
+}
+
 extern long lIterates;
 extern long lNumber;
 extern long lChainLength;
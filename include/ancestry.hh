@@ -0,0 +1,166 @@
+//   SMCTC: ancestry.hh
+//
+//   This file is part of SMCTC.
+//
+//   SMCTC is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   SMCTC is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with SMCTC.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+//! \file
+//! \brief A history of the sampler which retains only the surviving lineages.
+//!
+//! This file contains the smc::ancestry class, which is used in place of smc::history when the sampler is created
+//! with SMC_HISTORY_ANCESTRY.
+
+#ifndef __SMC_ANCESTRY_HH
+#define __SMC_ANCESTRY_HH 1.0
+
+#include <iostream>
+#include <vector>
+
+#include "genealogy.hh"
+#include "history.hh"
+#include "weights.hh"
+
+namespace smc
+{
+/// A template class for a history which stores the particles of surviving lineages only.
+
+///    Like smc::history, this class should be instantiated with the particle type rather than the type of the
+///    sample space. Each generation is recorded as its ancestor indices, and the particles themselves are kept only
+///    for as long as they have a descendant in the most recent generation; the summary of each generation (its size,
+///    effective sample size, MCMC acceptance count and flags) is kept permanently. The full path of any particle of
+///    the most recent generation can be reconstructed from the stored particles.
+template <class Particle> class ancestry
+{
+private:
+    ///The genealogical tree of the stored particles.
+    genealogy Tree;
+    ///The stored particles, indexed by their node identifier within Tree.
+    std::vector<Particle> Values;
+    ///The number of particles in each generation.
+    std::vector<long> lNumbers;
+    ///The effective sample size of each generation.
+    std::vector<double> dESS;
+    ///The number of MCMC moves accepted during each generation.
+    std::vector<int> nAccepts;
+    ///The flags of each generation.
+    std::vector<historyflags> Flags;
+    ///Workspace used to collect the identifiers of released nodes.
+    std::vector<long> lReleased;
+
+public:
+    ///Discard every generation.
+    void Clear(void);
+    ///Append a generation of particles with the specified parents to the history.
+    void Push(long lNumber, const Particle* pNew, const unsigned int* uParents, int nAccept, historyflags hf);
+
+    ///Returns the number of generations recorded.
+    long GetLength(void) const { return lNumbers.size(); }
+    ///Returns the number of particles in the specified generation.
+    long GetNumber(long lGeneration) const { return lNumbers[lGeneration]; }
+    ///Returns the effective sample size of the specified generation.
+    double GetESS(long lGeneration) const { return dESS[lGeneration]; }
+    ///Returns the number of particles currently stored.
+    long GetStoredCount(void) const { return Tree.GetNodeCount(); }
+    ///Returns the genealogical tree of the stored particles.
+    const genealogy & GetGenealogy(void) const { return Tree; }
+    ///Returns the stored particle with the specified node identifier.
+    const Particle & GetParticle(long lNode) const { return Values[lNode]; }
+    ///Reconstruct the path of particle n of the most recent generation.
+    void GetPath(long n, std::vector<Particle> & pPath) const;
+
+    ///Output a vector indicating the number of accepted MCMC moves at each time instance
+    void OstreamMCMCRecordToStream(std::ostream &os) const;
+    ///Output a 0-1 value vector indicating the times at which resampling occured to an output stream
+    void OstreamResamplingRecordToStream(std::ostream &os) const;
+};
+
+template <class Particle>
+void ancestry<Particle>::Clear(void)
+{
+    Tree.Clear();
+    Values.clear();
+    lNumbers.clear();
+    dESS.clear();
+    nAccepts.clear();
+    Flags.clear();
+}
+
+/// \param lNumber The number of particles present in this generation of the system.
+/// \param pNew    An array containing the particles present in this generation of the system.
+/// \param uParents The index, within the previous generation, of the parent of each particle; null if particle i
+/// is the child of particle i of the previous generation.
+/// \param nAccept The number of accepted MCMC moves during this iteration of the system.
+/// \param hf      The historyflags associated with this generation of the system.
+template <class Particle>
+void ancestry<Particle>::Push(long lNumber, const Particle* pNew, const unsigned int* uParents, int nAccept, historyflags hf)
+{
+    lReleased.clear();
+    Tree.Extend(lNumber, uParents, &lReleased);
+
+    //Drop the values of the extinct particles, which may own storage of their own.
+    for(size_t i = 0; i < lReleased.size(); ++i)
+        Values[lReleased[i]] = Particle();
+
+    if(Values.size() < (size_t)Tree.GetNodeLimit())
+        Values.resize(Tree.GetNodeLimit());
+    std::vector<double> dLogWeights(lNumber);
+    for(long i = 0; i < lNumber; ++i) {
+        Values[Tree.GetLeaf(i)] = pNew[i];
+        dLogWeights[i] = pNew[i].GetLogWeight();
+    }
+
+    lNumbers.push_back(lNumber);
+    dESS.push_back(EffectiveSampleSize(dLogWeights.data(), lNumber));
+    nAccepts.push_back(nAccept);
+    Flags.push_back(hf);
+}
+
+/// \param n The index of the particle within the most recent generation.
+/// \param pPath The vector in which the ancestors of the particle, from the first generation to the particle
+/// itself, are returned.
+template <class Particle>
+void ancestry<Particle>::GetPath(long n, std::vector<Particle> & pPath) const
+{
+    std::vector<long> lLineage;
+    Tree.GetLineage(n, lLineage);
+    pPath.resize(lLineage.size());
+    for(size_t t = 0; t < lLineage.size(); ++t)
+        pPath[t] = Values[lLineage[t]];
+}
+
+/// \param os The output stream to send the data to.
+template <class Particle>
+void ancestry<Particle>::OstreamMCMCRecordToStream(std::ostream &os) const
+{
+    for(size_t t = 0; t < nAccepts.size(); ++t)
+        os << nAccepts[t] << std::endl;
+}
+
+/// \param os The output stream to send the data to.
+template <class Particle>
+void ancestry<Particle>::OstreamResamplingRecordToStream(std::ostream &os) const
+{
+    for(size_t t = 0; t < Flags.size(); ++t) {
+        if(Flags[t].WasResampled())
+            os << "1\t";
+        else
+            os << "0\t";
+
+        os << dESS[t] << std::endl;
+    }
+}
+}
+
+#endif
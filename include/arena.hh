@@ -0,0 +1,145 @@
+//   SMCTC: arena.hh
+//
+//   This file is part of SMCTC.
+//
+//   SMCTC is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   SMCTC is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with SMCTC.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+//! \file
+//! \brief Scratch storage for move functions which is released in bulk when each call returns.
+//!
+//! This file contains the smc::arena class, from which storage is allocated by advancing a pointer, and the
+//! smc::arena_allocator class which allows standard containers to be allocated from an arena. Arenas hold only the
+//! temporary storage of move functions: the particles themselves and the history outlive the calls, so they are not
+//! allocated from arenas.
+
+#ifndef __SMC_ARENA_HH
+#define __SMC_ARENA_HH 1.0
+
+#include <cstddef>
+#include <vector>
+
+#ifndef SMC_ARENA_CHUNK_SIZE
+///The size, in bytes, of the blocks of memory which an arena obtains from the system.
+#define SMC_ARENA_CHUNK_SIZE (1 << 16)
+#endif
+
+namespace smc
+{
+/// A region of memory from which storage is allocated by advancing a pointer, and which is released all at once.
+
+///    Allocation from an arena takes no lock and individual allocations are never freed, so an arena is suited to
+///    the temporary storage used by move functions, which would otherwise contend for the general purpose allocator
+///    when the particles are moved in parallel. Each sampler keeps an arena for each of its threads and makes it the
+///    one returned by arena::Local(), through an arena::scope, around each call which initialises, moves or applies
+///    MCMC to particles; the storage is released when the call returns, so it must not outlive the call. Elsewhere,
+///    arena::Local() returns an arena belonging to the calling thread which is only released by an explicit call to
+///    Reset() or by the end of a scope.
+class arena
+{
+private:
+    /// A block of memory obtained from the system.
+    struct chunk {
+        char* pData;      //!< The start of the block.
+        size_t uSize;     //!< The size of the block in bytes.
+    };
+
+    ///The blocks owned by the arena.
+    std::vector<chunk> Chunks;
+    ///The block from which storage is currently allocated.
+    size_t uCurrent;
+    ///The number of bytes allocated from the current block.
+    size_t uUsed;
+
+    ///The arena made current on the calling thread by the innermost scope, or null if there is none.
+    static thread_local arena* pCurrent;
+
+public:
+    arena();
+    ~arena();
+
+    ///Returns uBytes of storage aligned to uAlign bytes, which remains valid until the arena is next released.
+    void* Allocate(size_t uBytes, size_t uAlign = alignof(std::max_align_t));
+    ///Release all of the storage allocated from the arena, keeping the blocks for reuse.
+    void Reset(void);
+    ///Returns the number of bytes held by the arena.
+    size_t GetCapacity(void) const;
+
+    ///Returns the arena made current on the calling thread, or the thread's own arena if none has been.
+    static arena & Local(void);
+
+    /// Makes an arena the one returned by arena::Local() on the calling thread for as long as the scope exists.
+
+    ///    The storage allocated from the arena while the scope exists is released when it ends, so an arena which is
+    ///    made current around each call of a move function needs to hold the scratch storage of one call at a time.
+    class scope
+    {
+    private:
+        arena* pPrevious;
+        arena* pArena;
+        size_t uCurrent;
+        size_t uUsed;
+
+    public:
+        explicit scope(arena & aCurrent) :
+            pPrevious(pCurrent), pArena(&aCurrent), uCurrent(aCurrent.uCurrent), uUsed(aCurrent.uUsed)
+        { pCurrent = &aCurrent; }
+        ~scope() { pArena->uCurrent = uCurrent; pArena->uUsed = uUsed; pCurrent = pPrevious; }
+
+    private:
+        scope(const scope &);
+        scope & operator=(const scope &);
+    };
+
+private:
+    arena(const arena &);
+    arena & operator=(const arena &);
+};
+
+/// An allocator which obtains its storage from an arena, for use by containers of temporary values.
+
+///    Deallocation does nothing: the storage is reclaimed when the arena is released. A default constructed
+///    allocator uses the arena returned by arena::Local() on the thread which constructs it.
+template <class T> class arena_allocator
+{
+private:
+    arena* pArena;
+
+    template <class U> friend class arena_allocator;
+
+public:
+    typedef T value_type;
+
+    arena_allocator() : pArena(&arena::Local()) {}
+    explicit arena_allocator(arena & aFrom) : pArena(&aFrom) {}
+    template <class U> arena_allocator(const arena_allocator<U> & aFrom) : pArena(aFrom.pArena) {}
+
+    ///Allocate space for n objects from the arena.
+    T* allocate(std::size_t n) { return static_cast<T*>(pArena->Allocate(n * sizeof(T), alignof(T))); }
+    ///Storage is released with the arena, so this does nothing.
+    void deallocate(T*, std::size_t) {}
+
+    ///Returns the arena from which storage is allocated.
+    arena* GetArena(void) const { return pArena; }
+
+    template <class U> struct rebind { typedef arena_allocator<U> other; };
+};
+
+template <class T, class U>
+bool operator==(const arena_allocator<T> & a, const arena_allocator<U> & b) { return a.GetArena() == b.GetArena(); }
+template <class T, class U>
+bool operator!=(const arena_allocator<T> & a, const arena_allocator<U> & b) { return a.GetArena() != b.GetArena(); }
+}
+
+#endif
@@ -0,0 +1,301 @@
+//   SMCTC: diskhistory.hh
+//
+//   This file is part of SMCTC.
+//
+//   SMCTC is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   SMCTC is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with SMCTC.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+//! \file
+//! \brief A history of the sampler which is stored in a file.
+//!
+//! This file contains the smc::historyfile class, which appends to a file through a buffer and reads it back through
+//! a memory mapping, and the smc::diskhistory class which uses it to store the history of a sampler created with
+//! SMC_HISTORY_DISK.
+
+#ifndef __SMC_DISKHISTORY_HH
+#define __SMC_DISKHISTORY_HH 1.0
+
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "history.hh"
+#include "population.hh"
+#include "smc-exception.hh"
+#include "weights.hh"
+
+#ifndef SMC_HISTORY_BUFFER_SIZE
+///The size, in bytes, of the buffer through which a disk history is written.
+#define SMC_HISTORY_BUFFER_SIZE (1 << 20)
+#endif
+
+namespace smc
+{
+/// A file which is written sequentially through a buffer and read through a memory mapping.
+class historyfile
+{
+private:
+    ///The file being written.
+    std::FILE* pFile;
+    ///The buffer through which the file is written.
+    std::vector<char> Buffer;
+    ///The number of bytes in the file.
+    long lSize;
+    ///The current mapping of the file, or null.
+    void* pMap;
+    ///The number of bytes of the file covered by the mapping.
+    long lMapSize;
+
+    ///Remove the mapping, if any.
+    void Unmap(void);
+
+public:
+    historyfile();
+    ~historyfile();
+
+    ///Open the named file for writing, discarding its contents, or an anonymous temporary file if szPath is null.
+    void Open(const char* szPath);
+    ///Close the file.
+    void Close(void);
+    ///Returns true if the file is open.
+    bool IsOpen(void) const { return pFile != 0; }
+    ///Append n bytes to the file.
+    void Write(const void* pData, size_t n);
+    ///Returns the number of bytes in the file.
+    long GetSize(void) const { return lSize; }
+    ///Returns the address at which the whole file is mapped into memory.
+    const char* Map(void);
+    ///Discard every byte of the file after the first lNewSize.
+    void Truncate(long lNewSize);
+
+private:
+    historyfile(const historyfile &);
+    historyfile & operator=(const historyfile &);
+};
+
+/// A template class for a history of the particle system which is stored in a file.
+
+///    Each generation is appended to the file as a header, the contiguous array of log weights, the offset of each
+///    particle value within the generation's values and the values themselves, so the writes are sequential and only
+///    the offsets of the generations are held in memory. The file is memory mapped when it is read, by the path
+///    sampling integral, the effective sample size of a past generation or the removal of the latest generation.
+///
+///    The particle values are written and read by smc::serialiser<Space>, which stores trivially copyable types as
+///    their raw bytes and may be specialised for any other type.
+template <class Space> class diskhistory
+{
+private:
+    /// The record which precedes the particles of each generation within the file.
+    struct header {
+        long lNumber;     //!< The number of particles in the generation.
+        int nAccepted;    //!< The number of MCMC moves accepted during the generation.
+        int nResampled;   //!< Nonzero if the generation was resampled.
+        double dESS;      //!< The effective sample size of the generation.
+    };
+
+    ///The file in which the generations are stored.
+    mutable historyfile File;
+    ///The path of the file, or empty to use an anonymous temporary file.
+    std::string sPath;
+    ///The offset within the file of each generation.
+    std::vector<long> lOffsets;
+
+    ///Returns the header of the specified generation.
+    const header* GetHeader(long lGeneration) const
+    { return reinterpret_cast<const header*>(File.Map() + lOffsets[lGeneration]); }
+    ///Workspace in which the values of a generation are serialised.
+    std::vector<char> Bytes;
+    ///Workspace in which the offsets of the values of a generation are collected.
+    std::vector<long> lValueOffsets;
+
+    ///Returns the offsets, within the values of the specified generation, of each value and of the end of the last.
+    const long* GetValueOffsets(long lGeneration) const
+    { return reinterpret_cast<const long*>(GetLogWeights(lGeneration) + GetNumber(lGeneration)); }
+    ///Returns the address of the values of the specified generation.
+    const char* GetValues(long lGeneration) const
+    { return reinterpret_cast<const char*>(GetValueOffsets(lGeneration) + GetNumber(lGeneration) + 1); }
+    ///Set sValue to value n of the specified generation.
+    void ReadValue(long lGeneration, long n, Space & sValue) const
+    {
+        const long* lOffset = GetValueOffsets(lGeneration);
+        serialiser<Space>::Read(GetValues(lGeneration) + lOffset[n], lOffset[n + 1] - lOffset[n], sValue);
+    }
+
+public:
+    ///Set the file in which the history is to be stored; by default an anonymous temporary file is used.
+    void SetPath(const std::string & sNewPath) { sPath = sNewPath; }
+    ///Open the file, discarding any generations which it holds.
+    void Clear(void);
+    ///Append the particles of the supplied population to the history.
+    void Push(const population<Space> & pParticles, int nAccept, historyflags hf);
+    ///Remove the latest generation from the history and place its particles in the supplied population.
+    void Pop(population<Space>* pParticles, int* pnAccept);
+
+    ///Returns the number of generations recorded within the history.
+    long GetLength(void) const { return lOffsets.size(); }
+    ///Returns the number of particles in the specified generation.
+    long GetNumber(long lGeneration) const { return GetHeader(lGeneration)->lNumber; }
+    ///Returns the effective sample size of the specified generation.
+    double GetESS(long lGeneration) const { return GetHeader(lGeneration)->dESS; }
+    ///Returns the number of MCMC moves accepted during the specified generation.
+    int AcceptCount(long lGeneration) const { return GetHeader(lGeneration)->nAccepted; }
+    ///Returns nonzero if the specified generation was resampled.
+    int WasResampled(long lGeneration) const { return GetHeader(lGeneration)->nResampled; }
+    ///Returns the log weights of the specified generation; the pointer is valid until the history is next modified.
+    const double* GetLogWeights(long lGeneration) const
+    { return reinterpret_cast<const double*>(File.Map() + lOffsets[lGeneration] + sizeof(header)); }
+    ///Returns particle n of the specified generation.
+    particle<Space> GetParticle(long lGeneration, long n) const;
+
+    ///Integrate the supplied function according to the empirical measure of the specified generation.
+    double Integrate(long lGeneration, double(*pIntegrand)(long, const particle<Space>&, void*), void* pAuxiliary) const;
+    ///Integrate the supplied function over the path of the particle ensemble.
+    double IntegratePathSampling(double(*pIntegrand)(long, const particle<Space>&, void*), double(*pWidth)(long, void*), void* pAuxiliary) const;
+
+    ///Output a vector indicating the number of accepted MCMC moves at each time instance
+    void OstreamMCMCRecordToStream(std::ostream &os) const;
+    ///Output a 0-1 value vector indicating the times at which resampling occured to an output stream
+    void OstreamResamplingRecordToStream(std::ostream &os) const;
+};
+
+template <class Space>
+void diskhistory<Space>::Clear(void)
+{
+    if(!has_serialiser<Space>::value)
+        throw SMC_EXCEPTION(SMCX_UNSUPPORTED_HISTORY, "The history can only be stored on disk if the sample space type is trivially copyable or smc::serialiser is specialised for it.");
+
+    File.Open(sPath.empty() ? 0 : sPath.c_str());
+    lOffsets.clear();
+}
+
+/// \param pParticles The particles present in this generation of the system.
+/// \param nAccept The number of accepted MCMC moves during this iteration of the system.
+/// \param hf      The historyflags associated with this generation of the system.
+template <class Space>
+void diskhistory<Space>::Push(const population<Space> & pParticles, int nAccept, historyflags hf)
+{
+    header h;
+    h.lNumber = pParticles.size();
+    h.nAccepted = nAccept;
+    h.nResampled = hf.WasResampled();
+    h.dESS = EffectiveSampleSize(pParticles.GetLogWeights(), h.lNumber);
+
+    Bytes.clear();
+    lValueOffsets.resize(h.lNumber + 1);
+    for(long i = 0; i < h.lNumber; ++i) {
+        lValueOffsets[i] = Bytes.size();
+        serialiser<Space>::Write(pParticles.GetValue(i), Bytes);
+    }
+    lValueOffsets[h.lNumber] = Bytes.size();
+
+    //The header, the log weights and the offsets are multiples of eight bytes long, so every generation is aligned.
+    lOffsets.push_back(File.GetSize());
+    File.Write(&h, sizeof(header));
+    File.Write(pParticles.GetLogWeights(), h.lNumber * sizeof(double));
+    File.Write(lValueOffsets.data(), (h.lNumber + 1) * sizeof(long));
+    File.Write(Bytes.data(), Bytes.size());
+    //Pad the record so that the next header is aligned.
+    static const char cPadding[sizeof(double)] = {0};
+    File.Write(cPadding, (sizeof(double) - Bytes.size() % sizeof(double)) % sizeof(double));
+}
+
+/// \param pParticles If not null, the population in which the particles of the latest generation are returned.
+/// \param pnAccept If not null, the number of MCMC moves accepted during the latest generation is returned here.
+template <class Space>
+void diskhistory<Space>::Pop(population<Space>* pParticles, int* pnAccept)
+{
+    const long lGeneration = GetLength() - 1;
+    const long lNumber = GetNumber(lGeneration);
+    if(pnAccept)
+        *pnAccept = AcceptCount(lGeneration);
+
+    if(pParticles) {
+        pParticles->resize(lNumber);
+        const double* dLogWeights = GetLogWeights(lGeneration);
+        for(long i = 0; i < lNumber; ++i) {
+            ReadValue(lGeneration, i, *pParticles->GetValuePointer(i));
+            pParticles->SetLogWeight(i, dLogWeights[i]);
+        }
+    }
+
+    File.Truncate(lOffsets.back());
+    lOffsets.pop_back();
+}
+
+template <class Space>
+particle<Space> diskhistory<Space>::GetParticle(long lGeneration, long n) const
+{
+    particle<Space> pValue;
+    ReadValue(lGeneration, n, *pValue.GetValuePointer());
+    pValue.SetLogWeight(GetLogWeights(lGeneration)[n]);
+    return pValue;
+}
+
+/// \param lGeneration The generation, which is also passed to the integrand as the evolution time
+/// \param pIntegrand The function which is to be integrated
+/// \param pAuxiliary A pointer to additional information which is passed to the integrand function
+template <class Space>
+double diskhistory<Space>::Integrate(long lGeneration, double(*pIntegrand)(long, const particle<Space>&, void*), void* pAuxiliary) const
+{
+    const long lNumber = GetNumber(lGeneration);
+    std::vector<double> dWeights(lNumber);
+    NormalisedWeights(GetLogWeights(lGeneration), lNumber, dWeights.data());
+
+    compensated_sum rValue;
+    for(long i = 0; i < lNumber; ++i)
+        rValue.Add(dWeights[i] * pIntegrand(lGeneration, GetParticle(lGeneration, i), pAuxiliary));
+
+    return rValue.GetSum();
+}
+
+/// This performs the same trapezoidal integration as history::IntegratePathSampling, reading each generation from
+/// the mapped file in turn.
+///
+/// \param pIntegrand  The function to integrated. The first argument is evolution time, the second a particle at which the function is to be evaluated and the final argument is always pAuxiliary.
+/// \param pWidth      The function which returns the width of the path sampling grid at the specified evolution time. The final argument is always pAuxiliary
+/// \param pAuxiliary  A pointer to auxiliary data to pass to both of the above functions
+template <class Space>
+double diskhistory<Space>::IntegratePathSampling(double(*pIntegrand)(long, const particle<Space>&, void*), double(*pWidth)(long, void*), void* pAuxiliary) const
+{
+    compensated_sum rValue;
+    for(long lTime = 1; lTime < GetLength(); ++lTime)
+        rValue.Add(Integrate(lTime, pIntegrand, pAuxiliary) * pWidth(lTime, pAuxiliary));
+    return rValue.GetSum();
+}
+
+/// \param os The output stream to send the data to.
+template <class Space>
+void diskhistory<Space>::OstreamMCMCRecordToStream(std::ostream &os) const
+{
+    for(long t = 0; t < GetLength(); ++t)
+        os << AcceptCount(t) << std::endl;
+}
+
+/// \param os The output stream to send the data to.
+template <class Space>
+void diskhistory<Space>::OstreamResamplingRecordToStream(std::ostream &os) const
+{
+    for(long t = 0; t < GetLength(); ++t) {
+        if(WasResampled(t))
+            os << "1\t";
+        else
+            os << "0\t";
+
+        os << GetESS(t) << std::endl;
+    }
+}
+}
+
+#endif
@@ -0,0 +1,201 @@
+//   SMCTC: fastrng.hh
+//
+//   This file is part of SMCTC.
+//
+//   SMCTC is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   SMCTC is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with SMCTC.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+//! \file
+//! \brief A header-only random number generator.
+//!
+//! This file contains the definition of the smc::fastrng class, an alternative to smc::rng whose generator and
+//! distributions are defined inline so that they can be inlined into move functions.
+
+#ifndef __SMC_FASTRNG_HH
+#define __SMC_FASTRNG_HH 1.0
+
+#include <cmath>
+#include <cstddef>
+#include <stdint.h>
+
+#include "rng.hh"
+
+namespace smc
+{
+///A random number generator class based upon xoshiro256++ (Blackman and Vigna, 2018).
+
+///    This class provides the subset of the smc::rng interface which is used by the library itself, and may be used
+///    in its place by supplying it as the Rng template argument of smc::sampler, smc::moveset and smc::mcmc_moves.
+///    Everything is defined in this header, so draws made from within a move function can be inlined into it.
+///    Distributions which are not provided here remain available from smc::rng.
+class fastrng
+{
+private:
+    ///The seed from which the generator was created; its streams are derived from it.
+    uint64_t key;
+    ///The state of the generator.
+    uint64_t s[4];
+    ///The second normal variate of the most recent polar pair, if it has not yet been used.
+    double dSpare;
+    ///Nonzero if dSpare holds an unused variate.
+    int nHaveSpare;
+
+    static uint64_t Rotate(uint64_t x, int k) { return (x << k) | (x >> (64 - k)); }
+    ///One step of the splitmix64 generator, used to expand seeds into a full state.
+    static uint64_t SplitMix(uint64_t & x)
+    {
+        uint64_t z = (x += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
+
+public:
+    ///Initialise the random number generator using a fixed default seed
+    fastrng() { Seed(0); }
+    ///Initialise the random number generator using the specified seed
+    fastrng(unsigned long lSeed) { Seed(lSeed); }
+
+    ///Reinitialise the generator from the specified seed.
+    void Seed(unsigned long lSeed)
+    {
+        uint64_t x = key = lSeed;
+        for(int i = 0; i < 4; i++)
+            s[i] = SplitMix(x);
+        nHaveSpare = 0;
+    }
+
+    ///Allocate a generator keyed by lSeed whose streams may be selected using SetStream
+    static fastrng* NewStream(unsigned long lSeed) { return new fastrng(lSeed); }
+    ///Reseed the generator with a state derived from its key and the specified stream and substream
+    void SetStream(unsigned long lStream, unsigned long lSubstream)
+    {
+        uint64_t x = key;
+        x = SplitMix(x) ^ lStream;
+        x = SplitMix(x) ^ lSubstream;
+        for(int i = 0; i < 4; i++)
+            s[i] = SplitMix(x);
+        nHaveSpare = 0;
+    }
+
+    ///Returns the next 64 bits of output
+    uint64_t Next(void)
+    {
+        uint64_t rValue = Rotate(s[0] + s[3], 23) + s[0];
+        uint64_t t = s[1] << 17;
+        s[2] ^= s[0];
+        s[3] ^= s[1];
+        s[1] ^= s[2];
+        s[0] ^= s[3];
+        s[2] ^= t;
+        s[3] = Rotate(s[3], 45);
+        return rValue;
+    }
+
+    ///Generate a multinomial random vector with parameters (n,w[1:k]) and store it in X
+    void Multinomial(unsigned n, unsigned k, const double* w, unsigned* X);
+    ///Returns a random integer generated uniformly between the minimum and maximum values specified
+    long UniformDiscrete(long lMin, long lMax)
+    {
+        uint64_t lRange = (uint64_t)(lMax - lMin) + 1;
+        //Reject the incomplete final copy of the range to avoid modulo bias.
+        uint64_t lLimit = lRange ? (0 - lRange) % lRange : 0;
+        uint64_t x;
+        do
+            x = Next();
+        while(x < lLimit);
+        return lMin + (long)(lRange ? x % lRange : x);
+    }
+
+    ///Returns a random number generated from an exponential distribution with the specified mean.
+    double Exponential(double dMean) { return -dMean * std::log(1.0 - UniformS()); }
+    ///Return a random number generated from a normal distribution with a specified mean and standard deviation
+    double Normal(double dMean, double dStd) { return dMean + dStd * NormalS(); }
+    ///Return a random number generated from a standard normal distribution
+    double NormalS(void)
+    {
+        if(nHaveSpare) {
+            nHaveSpare = 0;
+            return dSpare;
+        }
+        //Marsaglia's polar method produces two variates; the second is kept for the next call.
+        double u, v, r;
+        do {
+            u = 2.0 * UniformS() - 1.0;
+            v = 2.0 * UniformS() - 1.0;
+            r = u * u + v * v;
+        } while(r >= 1.0 || r == 0.0);
+        double dScale = std::sqrt(-2.0 * std::log(r) / r);
+        dSpare = v * dScale;
+        nHaveSpare = 1;
+        return u * dScale;
+    }
+    ///Return a random number generated uniformly between dMin and dMax
+    double Uniform(double dMin, double dMax) { return dMin + (dMax - dMin) * UniformS(); }
+    ///Returns a random number generated from the standard uniform[0,1) distribution
+    double UniformS(void) { return (Next() >> 11) * (1.0 / 9007199254740992.0); }
+
+    ///Fill pOut with n random numbers generated from an exponential distribution with the specified mean.
+    void ExponentialBatch(double* pOut, size_t n, double dMean)
+    {
+        for(size_t i = 0; i < n; i++)
+            pOut[i] = UniformS();
+        #pragma omp simd
+        for(size_t i = 0; i < n; i++)
+            pOut[i] = -dMean * std::log(1.0 - pOut[i]);
+    }
+    ///Fill pOut with n random numbers generated from a normal distribution with a specified mean and standard deviation
+    void NormalBatch(double* pOut, size_t n, double dMean, double dStd)
+    {
+        size_t nPairs = n / 2;
+        for(size_t i = 0; i < 2 * nPairs; i++)
+            pOut[i] = UniformS();
+        BoxMuller(pOut, nPairs, dMean, dStd);
+        if(n % 2)
+            pOut[n - 1] = Normal(dMean, dStd);
+    }
+    ///Fill pOut with n random numbers generated uniformly between dMin and dMax
+    void UniformBatch(double* pOut, size_t n, double dMin, double dMax)
+    {
+        for(size_t i = 0; i < n; i++)
+            pOut[i] = Uniform(dMin, dMax);
+    }
+};
+
+///This function draws each of the n entities independently from the categorical distribution with weights w, which
+///is exact and inexpensive for the small values of n and k for which it is used within the library.
+///     \param n Number of entities to assign.
+///     \param k Number of categories.
+///     \param w Weights of category elements
+///     \param X Array in which to return the sample values.
+inline void fastrng::Multinomial(unsigned n, unsigned k, const double* w, unsigned* X)
+{
+    double dSum = 0;
+    for(unsigned j = 0; j < k; j++) {
+        dSum += w[j];
+        X[j] = 0;
+    }
+    for(unsigned i = 0; i < n; i++) {
+        double u = dSum * UniformS();
+        unsigned j = 0;
+        while(j + 1 < k && u >= w[j]) {
+            u -= w[j];
+            j++;
+        }
+        X[j]++;
+    }
+}
+}
+
+#endif
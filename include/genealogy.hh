@@ -0,0 +1,105 @@
+//   SMCTC: genealogy.hh
+//
+//   This file is part of SMCTC.
+//
+//   SMCTC is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   SMCTC is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with SMCTC.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+//! \file
+//! \brief A class which records the ancestry of a particle system.
+//!
+//! This file contains the smc::genealogy class, which stores the tree formed by the surviving lineages of a particle
+//! system and discards branches as they become extinct.
+
+#ifndef __SMC_GENEALOGY_HH
+#define __SMC_GENEALOGY_HH 1.0
+
+#include <iosfwd>
+#include <vector>
+
+namespace smc
+{
+/// The genealogical tree of the surviving lineages of a particle system.
+
+///    Every particle of every generation which has a descendant in the most recent generation is represented by a
+///    node holding the index of its parent node, its generation, its index within that generation and its number of
+///    children. When a new generation is
+///    added, the nodes of the previous generation which have no children are released, together with any ancestors
+///    which are left without children as a result, so the tree never holds extinct branches. The identifiers of
+///    released nodes are reused, which allows callers to keep per-node data in arrays indexed by node identifier.
+///
+///    The number of nodes is bounded by the number of generations plus, with high probability, a multiple of
+///    N log N (Jacob, Murray and Rubenthaler, 2015).
+class genealogy
+{
+private:
+    /// A particle in the tree.
+    struct node {
+        long lParent;      //!< The identifier of the parent node, or -1 for the first generation.
+        long lGeneration;  //!< The generation to which the particle belongs, or -1 if the node has been released.
+        long lIndex;       //!< The index of the particle within its generation.
+        long lChildren;    //!< The number of particles in the following generation descended from this one.
+    };
+
+    ///The nodes; those which have been released are listed in lFree.
+    std::vector<node> Nodes;
+    ///The identifiers of released nodes, available for reuse.
+    std::vector<long> lFree;
+    ///The identifiers of the nodes of the most recent generation.
+    std::vector<long> lLeaves;
+    ///The number of generations added so far.
+    long lGenerations;
+
+    ///Allocate a node, reusing a released identifier if there is one.
+    long NewNode(long lParent, long lIndex);
+    ///Release a node which has no children, and any of its ancestors which are left without children.
+    void Release(long lNode, std::vector<long>* plReleased);
+
+public:
+    ///Create an empty genealogy.
+    genealogy();
+
+    ///Discard every generation.
+    void Clear(void);
+    ///Add a generation of lNumber particles whose parents are given by their indices in the previous generation.
+    void Extend(long lNumber, const unsigned int* uParents, std::vector<long>* plReleased = 0);
+
+    ///Returns the number of generations which have been added.
+    long GetLength(void) const { return lGenerations; }
+    ///Returns the number of particles in the most recent generation.
+    long GetNumber(void) const { return lLeaves.size(); }
+    ///Returns the number of nodes currently held.
+    long GetNodeCount(void) const { return Nodes.size() - lFree.size(); }
+    ///Returns the largest node identifier in use, plus one.
+    long GetNodeLimit(void) const { return Nodes.size(); }
+    ///Returns the identifier of the node for particle n of the most recent generation.
+    long GetLeaf(long n) const { return lLeaves[n]; }
+    ///Returns the identifier of the parent of a node, or -1 if it belongs to the first generation.
+    long GetParent(long lNode) const { return Nodes[lNode].lParent; }
+    ///Returns the generation of a node.
+    long GetGeneration(long lNode) const { return Nodes[lNode].lGeneration; }
+    ///Returns the index of a node's particle within its generation.
+    long GetIndex(long lNode) const { return Nodes[lNode].lIndex; }
+    ///Returns the number of children of a node.
+    long GetChildren(long lNode) const { return Nodes[lNode].lChildren; }
+    ///Write the identifiers of the ancestors of particle n of the most recent generation, oldest first, to lPath.
+    void GetLineage(long n, std::vector<long> & lPath) const;
+    ///Returns the identifier of the most recent common ancestor of the most recent generation, or -1 if it has none.
+    long GetMRCA(void) const;
+    ///Write the tree to the specified output stream in the Graphviz dot format.
+    void StreamGraph(std::ostream & os) const;
+};
+}
+
+#endif
@@ -22,11 +22,17 @@
 //! \brief Classes and function related to the history of the sampler.
 //!
 //! This file contains template definitions for the classes used to store the history of an SMCTC sampler.
-//! It defines smc::history, smc::historyelement and smc::history.
+//! It defines smc::historyflags, smc::historyelement and smc::history.
 
 #ifndef __SMC_HISTORY_HH
 #define __SMC_HISTORY_HH 1.0
 
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#include "weights.hh"
+
 namespace smc
 {
 /// The historyflags class holds a set of flags which describe various properties of the particle system at a given time.
@@ -40,153 +46,68 @@ public:
     historyflags(int wasResampled);
 
     ///This function returns true if the flag set indicates that the ensemble was resampled during the described iteration.
-    int WasResampled(void) {return Resampled;}
+    int WasResampled(void) const {return Resampled;}
 };
 
-/// A template class for the elements of a linked list to be used for the history of the sampler.
+/// A template class for the generations stored within the history of the sampler.
+
+///    Each element holds a copy of the particles of one generation together with a summary of that generation, which is
+///    computed once when the element is created.
 template <class Particle>class historyelement
 {
 private:
     long number; //!< The number of particles (presently redundant as this is not a function of iteration)
     int nAccepted; //!< Number of MCMC moves accepted during this iteration.
-    Particle* value; //!< The particles themselves (values and weights)
+    std::vector<Particle> value; //!< The particles themselves (values and weights)
     historyflags flags; //!< Flags associated with this iteration.
-    historyelement<Particle> *pLast; //!< The parent of this node.
-    historyelement<Particle> *pNext; //!< The child of this node.
+    double dESS; //!< The effective sample size of the particles.
+    double dLogNormaliser; //!< The natural logarithm of the sum of the particle weights.
 
 public:
-    /// The null constructor creates an empty history element.
-    historyelement();
     /// A constructor with four arguments initialises the particle set.
-    historyelement(long lNumber, Particle* pNew, int nAccepts, historyflags hf);
-    /// A constructor with six arguments initialises the whole structure.
-    historyelement(long lNumber, Particle* pNew, historyelement<Particle>* pParent, historyelement<Particle>* pChild, int nAccepts, historyflags  hf);
-
-    /// The destructor tidies up.
-    ~historyelement();
+    historyelement(long lNumber, const Particle* pNew, int nAccepts, historyflags hf);
 
     /// Returns the effective sample size of this particle generation.
-    double GetESS(void) const;
+    double GetESS(void) const { return dESS; }
+    /// Returns the natural logarithm of the sum of the weights of this particle generation.
+    double GetLogNormaliser(void) const { return dLogNormaliser; }
     /// Returns the flags
     historyflags GetFlags(void) const {return flags;}
-    /// Returns the parent of this element.
-    historyelement<Particle> * GetLast(void) const { return pLast; }
-    /// Returns the child of this element.
-    historyelement<Particle> * GetNext(void) const { return pNext; }
     /// Returns the number of particles present.
     long GetNumber(void) const {return number;}
     /// Returns a pointer to the current particle set.
-    Particle * GetValues(void) const { return value; }
-    /// Add a new history element with the specified values after the current one and maintain the list structure.
-    void InsertAfter(long lNumber, Particle * pNew);
+    const Particle * GetValues(void) const { return value.data(); }
+    /// Returns a pointer to the current particle set, from which the particles may be moved.
+    Particle * GetValues(void) { return value.data(); }
     /// Integrate the supplied function according to the empirical measure of the particle ensemble.
-    long double Integrate(long lTime, double(*pIntegrand)(long, const Particle&, void*), void* pAuxiliary);
-    /// Sets the elements parent.
-    void SetLast(historyelement<Particle>* pParent) {pLast = pParent; }
-    /// Sets the elements child.
-    void SetNext(historyelement<Particle>* pChild) {pNext = pChild; }
-    /// Sets the particle set to the specified values.
-    void SetValue(long lNumber, Particle * pNew);
+    double Integrate(long lTime, double(*pIntegrand)(long, const Particle&, void*), void* pAuxiliary) const;
 
     /// Returns the number of MCMC moves accepted during this iteration.
-    int AcceptCount(void) {return nAccepted; }
+    int AcceptCount(void) const {return nAccepted; }
     /// Returns true if the particle set
-    int WasResampled(void) {return flags.WasResampled(); }
-    /// \brief The left shift operator returns the element a number of positions prior to this one.
-    ///
-    /// \param ulCount The number of positions by which to shift.
-    /// \return The element a number of positions before this one.
-
-    historyelement<Particle> operator<<(unsigned long ulCount) {
-        if(ulCount)
-            return this->pLast << (--ulCount);
-        else
-            return *this;
-    }
-
-    ///\brief The right shift operator returns the element a number of positions after this one.
-    ///
-    /// \param ulCount The number of positions by which to shift.
-    /// \return The right shift operator returns the element a number of positions after this one.
-    historyelement<Particle> operator>>(unsigned long ulCount) {
-        if(ulCount)
-            return this->pNext << (--ulCount);
-        else
-            return *this;
-    }
-
+    int WasResampled(void) const {return flags.WasResampled(); }
 };
 
-template <class Particle>
-historyelement<Particle>::historyelement()
-{
-    number = 0;
-    value = NULL;
-    nAccepted = 0;
-    pLast = NULL;
-    pNext = NULL;
-}
-
-
 /// \param lNumber The number of particles present in the particle generation
 /// \param pNew    The array of particles which are present in the particle generation
 /// \param nAccepts The number of MCMC moves that were accepted during this particle generation
 /// \param hf      The historyflags associated with the particle generation
 
 template <class Particle>
-historyelement<Particle>::historyelement(long lNumber, Particle* pNew, int nAccepts, historyflags hf) :
+historyelement<Particle>::historyelement(long lNumber, const Particle* pNew, int nAccepts, historyflags hf) :
+    number(lNumber),
+    nAccepted(nAccepts),
+    value(pNew, pNew + lNumber),
     flags(hf)
 {
-    number = lNumber;
-    value = new Particle[number];
-    for(int i = 0; i < number; i++)
-        value[i] = pNew[i];
-
-    nAccepted = nAccepts;
-    pLast = NULL;
-    pNext = NULL;
-}
-
-/// \param lNumber The number of particles present in the particle generation
-/// \param pNew    The array of particles which are present in the particle generation
-/// \param pParent A pointer to the previous particle generation
-/// \param pChild  A pointer to the next particle generation
-/// \param nAccepts The number of MCMC moves that were accepted during this particle generation
-/// \param hf      The historyflags associated with the particle generation
-template <class Particle>
-historyelement<Particle>::historyelement(long lNumber, Particle* pNew,
-        historyelement<Particle>* pParent, historyelement<Particle>* pChild,
-        int nAccepts, historyflags hf) :
-    flags(hf)
-{
-    number = lNumber;
-    value = new Particle[number];
-    for(int i = 0; i < number; i++)
-        value[i] = pNew[i];
-
-    nAccepted = nAccepts;
-    pLast = pParent;
-    pNext = pChild;
-}
-
-template <class Particle>
-historyelement<Particle>::~historyelement(void)
-{
-    if(value)
-        delete [] value;
-}
-
-template <class Particle>
-double historyelement<Particle>::GetESS(void) const
-{
-    double sum = 0;
-    double sumsq = 0;
-
-    for(int i = 0; i < number; i++) {
-        sum += exp(value[i].GetLogWeight());
-        sumsq += exp(2.0 * value[i].GetLogWeight());
-    }
-    return (sum * sum) / sumsq;
+    std::vector<double> dLogWeights(number);
+    for(long i = 0; i < number; i++)
+        dLogWeights[i] = value[i].GetLogWeight();
+
+    weightsum wSum;
+    wSum.Add(dLogWeights.data(), number);
+    dESS = wSum.GetESS();
+    dLogNormaliser = wSum.GetLogSum();
 }
 
 /// \param lTime The timestep at which the integration is to be carried out
@@ -194,29 +115,18 @@ double historyelement<Particle>::GetESS(void) const
 /// \param pAuxiliary A pointer to additional information which is passed to the integrand function
 
 template <class Particle>
-long double historyelement<Particle>::Integrate(long lTime, double(*pIntegrand)(long, const Particle&, void*), void* pAuxiliary)
+double historyelement<Particle>::Integrate(long lTime, double(*pIntegrand)(long, const Particle&, void*), void* pAuxiliary) const
 {
-    long double rValue = 0;
-    long double wSum = 0;
+    std::vector<double> dWeights(number);
+    for(long i = 0; i < number; i++)
+        dWeights[i] = value[i].GetLogWeight();
+    NormalisedWeights(dWeights.data(), number, dWeights.data());
 
-    for(int i = 0; i < number; i++) {
-        rValue += expl(value[i].GetLogWeight()) * (long double)pIntegrand(lTime, value[i], pAuxiliary);
-        wSum  += expl(value[i].GetLogWeight());
-    }
+    compensated_sum rValue;
+    for(long i = 0; i < number; i++)
+        rValue.Add(dWeights[i] * pIntegrand(lTime, value[i], pAuxiliary));
 
-
-    rValue /= wSum;
-
-    return rValue;
-}
-
-/// \param lNumber The number of particles in the generation to be inserted
-/// \param pNew The value of the particle generation to be inserted
-
-template <class Particle>
-void historyelement<Particle>::InsertAfter(long lNumber, Particle * pNew)
-{
-    pNext = new historyelement<Particle>(lNumber, pNew, this, pNext);
+    return rValue.GetSum();
 }
 
 /// A template class for the history associated with a particle system evolving in SMC.
@@ -224,32 +134,34 @@ void historyelement<Particle>::InsertAfter(long lNumber, Particle * pNew)
 ///  The history is a template class which should have an associated class type corresponding to
 ///    a _particle_ of the desired type, not the type itself.
 ///
-///    Essentially, this is implemented as a doubly linked list.
+///    The generations are held in an array, so any generation and its summary can be found in constant time.
 
 
 template <class Particle> class history
 {
 private:
-    ///The length of the history in time steps
-    long  lLength;
-    ///The first time step
-    historyelement<Particle> *pRoot;
-    ///The most recent time step
-    historyelement<Particle> *pLeaf;
+    ///The generations, oldest first.
+    std::vector<historyelement<Particle> > Generations;
 
 public:
-    ///The argument free constructor creates an empty list.
-    history();
+    ///The argument free constructor creates an empty history.
+    history() {}
 
-    ///This function returns a pointer to the first element of the history.
-    const historyelement<Particle > * GetElement(void) const {return pRoot; }
+    ///This function returns a pointer to the specified generation of the history.
+    const historyelement<Particle> * GetElement(long lGeneration = 0) const { return &Generations[lGeneration]; }
 
     /// Returns the effective sample size of the specified particle generation.
-    double GetESS(long lGeneration) const;
+    double GetESS(long lGeneration) const { return Generations[lGeneration].GetESS(); }
+    /// Returns the natural logarithm of the sum of the weights of the specified particle generation.
+    double GetLogNormaliser(long lGeneration) const { return Generations[lGeneration].GetLogNormaliser(); }
+    /// Returns the number of MCMC moves accepted during the specified particle generation.
+    int AcceptCount(long lGeneration) const { return Generations[lGeneration].AcceptCount(); }
+    /// Returns nonzero if the specified particle generation was resampled.
+    int WasResampled(long lGeneration) const { return Generations[lGeneration].WasResampled(); }
     ///Returns the number of generations recorded within the history.
-    long GetLength(void) const { return lLength; }
+    long GetLength(void) const { return Generations.size(); }
     ///Integrate the supplied function over the path of the particle ensemble.
-    double IntegratePathSampling(double(*pIntegrand)(long, const Particle&, void*), double(*pWidth)(long, void*), void* pAuxiliary);
+    double IntegratePathSampling(double(*pIntegrand)(long, const Particle&, void*), double(*pWidth)(long, void*), void* pAuxiliary) const;
     double IntegratePathSamplingFinalStep(double(*pIntegrand)(long, const Particle&, void*), void* pAuxiliary) const;
 
     ///Output a vector indicating the number of accepted MCMC moves at each time instance
@@ -257,38 +169,18 @@ public:
     ///Output a 0-1 value vector indicating the times at which resampling occured to an output stream
     void OstreamResamplingRecordToStream(std::ostream &os) const;
 
-    ///Remove the terminal particle generation from the list and return that particle.
-    Particle * Pop(void);
+    ///Remove the terminal particle generation from the history; returns false if the history was empty.
+    bool Pop(void);
     ///Remove the terminal particle generation from the list and stick it in the supplied data structures
     void Pop(long* plNumber, Particle** ppNew, int* pnAccept, historyflags * phf);
     ///Append the supplied particle generation to the end of the list.
-    void Push(long lNumber, Particle * pNew, int nAccept, historyflags hf);
+    void Push(long lNumber, const Particle * pNew, int nAccept, historyflags hf);
 
 
     ///Display the list of particles in a human readable form.
     //  void StreamParticles(std::ostream & os);
 };
 
-/// This constructor simply sets the root and leaf pointers to NULL and the list length to zero.
-template <class Particle>
-history<Particle>::history()
-{
-    pRoot = NULL;
-    pLeaf = NULL;
-    lLength = 0;
-}
-/// Returns the effective sample size of the specified particle generation.
-template <class Particle>
-double  history<Particle>::GetESS(long lGeneration) const
-{
-    historyelement<Particle> * pCurrent = pRoot;
-    for(long l = 0; l < lGeneration; l++)
-        pCurrent = pCurrent->GetNext();
-    return pRoot->GetESS();
-}
-
-
-
 /// This function records the MCMC acceptance history to the specified output stream as a list of
 /// the number of moves accepted at each time instant.
 ///
@@ -296,12 +188,8 @@ double  history<Particle>::GetESS(long lGeneration) const
 template <class Particle>
 void history<Particle>:: OstreamMCMCRecordToStream(std::ostream &os) const
 {
-    historyelement<Particle> * pCurrent = pRoot;
-
-    while(pCurrent) {
-        os << pCurrent->AcceptCount() << std::endl;
-        pCurrent = pCurrent->GetNext();
-    }
+    for(size_t t = 0; t < Generations.size(); ++t)
+        os << Generations[t].AcceptCount() << std::endl;
 }
 /// This function records the resampling history to the specified output stream as a 0-1 valued list which takes
 /// the value 1 for those time instances when resampling occured and 0 otherwise.
@@ -310,17 +198,13 @@ void history<Particle>:: OstreamMCMCRecordToStream(std::ostream &os) const
 template <class Particle>
 void history<Particle>:: OstreamResamplingRecordToStream(std::ostream &os) const
 {
-    historyelement<Particle> * pCurrent = pRoot;
-
-    while(pCurrent) {
-        if(pCurrent->WasResampled())
+    for(size_t t = 0; t < Generations.size(); ++t) {
+        if(Generations[t].WasResampled())
             os << "1\t";
         else
             os << "0\t";
 
-        os << pCurrent->GetESS() << std::endl;
-
-        pCurrent = pCurrent->GetNext();
+        os << Generations[t].GetESS() << std::endl;
     }
 }
 
@@ -342,51 +226,31 @@ void history<Particle>:: OstreamResamplingRecordToStream(std::ostream &os) const
 /// \param pAuxiliary  A pointer to auxiliary data to pass to both of the above functions
 
 template <class Particle>
-double history<Particle>::IntegratePathSampling(double(*pIntegrand)(long, const Particle&, void*), double(*pWidth)(long, void*), void* pAuxiliary)
+double history<Particle>::IntegratePathSampling(double(*pIntegrand)(long, const Particle&, void*), double(*pWidth)(long, void*), void* pAuxiliary) const
 {
-    long lTime = 0;
-    long double rValue = 0.0;
-
-    historyelement<Particle> * pCurrent = pRoot;
-
-    lTime = 1;
-    pCurrent = pCurrent->GetNext();
-    while(pCurrent) {
-        rValue += pCurrent->Integrate(lTime, pIntegrand, pAuxiliary) * (long double)pWidth(lTime, pAuxiliary);
-        pCurrent = pCurrent->GetNext();
-        lTime++;
-    }
-    return ((double)rValue);
+    compensated_sum rValue;
+    for(long lTime = 1; lTime < GetLength(); lTime++)
+        rValue.Add(Generations[lTime].Integrate(lTime, pIntegrand, pAuxiliary) * pWidth(lTime, pAuxiliary));
+    return rValue.GetSum();
 }
 
 template <class Particle>
 double history<Particle>::IntegratePathSamplingFinalStep(double(*pIntegrand)(long, const Particle&, void*), void* pAuxiliary) const
 {
-    return pLeaf->Integrate(lLength - 1, pIntegrand, pAuxiliary);
+    return Generations.back().Integrate(GetLength() - 1, pIntegrand, pAuxiliary);
 }
 
 
 /// Pop() operates just as the standard stack operation does. It removes the particle generation currently occupying
-/// the terminal position in the chain, decrements the length counter and returns the particle set as an array.
+/// the terminal position in the history.
 template <class Particle>
-Particle * history<Particle>::Pop(void)
+bool history<Particle>::Pop(void)
 {
-    if(lLength == 0)
-        return NULL;
-
-    Particle * rValue = pLeaf->GetValues();
-
-    lLength--;
-
-    if(lLength == 0)
-        pRoot = pLeaf = 0;
-    else {
-        pLeaf = pLeaf->GetLast();
-        delete pLeaf->GetNext();
-        pLeaf->SetNext(NULL);
+    if(Generations.empty())
+        return false;
 
-    }
-    return rValue;
+    Generations.pop_back();
+    return true;
 }
 
 /// Pop operates as the usual stack operation
@@ -396,31 +260,21 @@ Particle * history<Particle>::Pop(void)
 template <class Particle>
 void history<Particle>::Pop(long* plNumber, Particle** ppNew, int* pnAccept, historyflags * phf)
 {
+    historyelement<Particle> & Leaf = Generations.back();
+
     if(plNumber)
-        (*plNumber) = pLeaf->GetNumber();
+        (*plNumber) = Leaf.GetNumber();
+    //The generation is discarded, so its particles are moved rather than copied.
     if(ppNew) {
-        for(long l = 0; l < *plNumber; l++)
-            (*ppNew)[l]    = pLeaf->GetValues()[l];
+        for(long l = 0; l < Leaf.GetNumber(); l++)
+            (*ppNew)[l]    = std::move(Leaf.GetValues()[l]);
     }
     if(pnAccept)
-        (*pnAccept) = pLeaf->AcceptCount();
+        (*pnAccept) = Leaf.AcceptCount();
     if(phf)
-        (*phf)      = pLeaf->GetFlags();
-
-    if(lLength <= 1) {
-        pRoot = NULL;
-        pLeaf = NULL;
-    } else {
-        pLeaf = pLeaf->GetLast();
-        //      delete pLeaf->GetNext();
-        pLeaf->SetNext(NULL);
-
-    }
-
-    lLength--;
-
-    return;
+        (*phf)      = Leaf.GetFlags();
 
+    Generations.pop_back();
 }
 
 /// Push operates just like the standard stack operation: it adds the specified particle set generation to the history
@@ -432,16 +286,9 @@ void history<Particle>::Pop(long* plNumber, Particle** ppNew, int* pnAccept, his
 /// \param hf      The historyflags associated with this generation of the system.
 
 template <class Particle>
-void history<Particle>::Push(long lNumber, Particle * pNew, int nAccepts, historyflags hf)
+void history<Particle>::Push(long lNumber, const Particle * pNew, int nAccepts, historyflags hf)
 {
-    if(lLength == 0) {
-        pRoot = new historyelement<Particle>(lNumber, pNew, nAccepts, hf);
-        pLeaf = pRoot;
-    } else {
-        pLeaf = new historyelement<Particle>(lNumber, pNew, pLeaf, NULL, nAccepts, hf);
-        pLeaf->GetLast()->SetNext(pLeaf);
-    }
-    lLength++;
+    Generations.emplace_back(lNumber, pNew, nAccepts, hf);
 }
 }
 
@@ -24,6 +24,7 @@
 #ifndef __SMC_MCMC_HH
 #define __SMC_MCMC_HH 1.0
 
+#include <algorithm>
 #include <cassert>
 #include <functional>
 #include <vector>
@@ -31,16 +32,21 @@
 #include "particle.hh"
 #include "rng.hh"
 
+#ifndef SMC_MCMC_SELECT_BUFFER
+///The number of MCMC moves which moveset::DoMCMC selects at a time, into a buffer on the stack.
+#define SMC_MCMC_SELECT_BUFFER 16
+#endif
+
 namespace smc
 {
 
 /// An MCMC move
 
-template <typename Space>
+template <typename Space, typename Rng = rng>
 class mcmc_moves
 {
 public:
-    typedef std::function<int(long, particle<Space> &, rng*)> mcmc_fn;
+    typedef std::function<int(long, particle<Space> &, Rng*)> mcmc_fn;
 
     mcmc_moves() :
         uniform_weights(true) {};
@@ -49,7 +55,7 @@ public:
     mcmc_moves(const std::vector<mcmc_fn>& moves, const std::vector<double>& weights) :
         moves(moves),
         weights(weights),
-        uniform_weights(AreWeightsUniform()) { };
+        uniform_weights(AreWeightsUniform()) { BuildAliasTable(); };
 
     /// \brief Initialize with some moves
     ///
@@ -57,66 +63,88 @@ public:
     mcmc_moves(const std::vector<mcmc_fn>& moves) :
         moves(moves),
         weights(std::vector<double>(moves.size(), 1.0)),
-        uniform_weights(AreWeightsUniform()) { };
+        uniform_weights(AreWeightsUniform()) { BuildAliasTable(); };
 
     /// Add an MCMC move with specied weight
     void AddMove(mcmc_fn move, double weight = 1.0);
     /// \brief Select a move randomly from a multinomial distribution using MCMC move weights as probabilities
 
     /// \returns A pointer to an MCMC move function
-    mcmc_fn* SelectMove(smc::rng* rng);
+    mcmc_fn* SelectMove(Rng* r);
     /// \brief Select moves randomly using weights as probabilities
 
     /// \returns A vector of functions to apply (may contain duplicates)
-    std::vector<mcmc_fn*> SelectMoves(smc::rng* r, unsigned n);
+    std::vector<mcmc_fn*> SelectMoves(Rng* r, unsigned n);
+    /// \brief Select n moves independently, using weights as probabilities, into the caller's array of n pointers
+
+    /// This performs no allocation and draws a single uniform variate for each move.
+    void SelectMoves(Rng* r, unsigned n, mcmc_fn** selected);
 
     inline size_t Count() const { return moves.size(); };
 private:
     bool AreWeightsUniform() const;
+    /// Build the alias table from the weights.
+    void BuildAliasTable();
 
     std::vector<mcmc_fn> moves;
     std::vector<double> weights;
     bool uniform_weights;
+    /// The probability of keeping each column of the alias table rather than taking its alias.
+    std::vector<double> alias_probability;
+    /// The move which shares each column of the alias table.
+    std::vector<unsigned> alias;
 };
 
 // Implementation
-template <typename Space>
-void mcmc_moves<Space>::AddMove(mcmc_fn move, double weight)
+template <typename Space, typename Rng>
+void mcmc_moves<Space, Rng>::AddMove(mcmc_fn move, double weight)
 {
     moves.push_back(move);
     weights.push_back(weight);
     uniform_weights = AreWeightsUniform();
+    BuildAliasTable();
 }
 
-template <typename Space>
-std::vector<std::function<int(long, particle<Space> &, rng*)>*> mcmc_moves<Space>::SelectMoves(smc::rng* r, unsigned n)
+template <typename Space, typename Rng>
+std::vector<typename mcmc_moves<Space, Rng>::mcmc_fn*> mcmc_moves<Space, Rng>::SelectMoves(Rng* r, unsigned n)
 {
-    std::vector<mcmc_moves<Space>::mcmc_fn*> result;
-    result.reserve(n);
+    std::vector<mcmc_fn*> result(n);
+    SelectMoves(r, n, result.data());
+    return result;
+}
 
-    assert(moves.size() >= 0);
+/// A single move is always selected, and equally weighted moves are chosen with a single discrete uniform variate.
+/// Otherwise the alias method of Walker (1977) is used: a uniform variate on [0, K) picks a column of the table,
+/// and its fractional part decides between the column's own move and its alias.
+template <typename Space, typename Rng>
+void mcmc_moves<Space, Rng>::SelectMoves(Rng* r, unsigned n, mcmc_fn** selected)
+{
     assert(moves.size() == weights.size());
-    if(moves.size() == 1) return std::vector<mcmc_moves<Space>::mcmc_fn*>(n, &(moves[0]));
-
-    // Unequal weights: sample from multinomial
-    std::vector<unsigned> counts(moves.size(), 0);
-    r->Multinomial(n, moves.size(), weights.data(), counts.data());
-    for(size_t i = 0; i < counts.size(); i++) {
-        for(size_t j = 0; j < counts[i]; j++)
-            result.push_back(&moves[i]);
+    const unsigned k = moves.size();
+
+    if(k == 1) {
+        for(unsigned i = 0; i < n; i++)
+            selected[i] = &moves[0];
+    } else if(uniform_weights) {
+        for(unsigned i = 0; i < n; i++)
+            selected[i] = &moves[r->UniformDiscrete(0, k - 1)];
+    } else {
+        for(unsigned i = 0; i < n; i++) {
+            double u = r->UniformS() * k;
+            unsigned column = std::min<unsigned>(u, k - 1);
+            selected[i] = &moves[(u - column < alias_probability[column]) ? column : alias[column]];
+        }
     }
-    assert(result.size() == n);
-    return result;
 }
 
-template <typename Space>
-std::function<int(long, particle<Space> &, rng*)>* mcmc_moves<Space>::SelectMove(smc::rng* rng)
+template <typename Space, typename Rng>
+typename mcmc_moves<Space, Rng>::mcmc_fn* mcmc_moves<Space, Rng>::SelectMove(Rng* r)
 {
-    return SelectMoves(rng, 1)[0];
+    return SelectMoves(r, 1)[0];
 }
 
-template <typename Space>
-bool mcmc_moves<Space>::AreWeightsUniform() const
+template <typename Space, typename Rng>
+bool mcmc_moves<Space, Rng>::AreWeightsUniform() const
 {
     if(weights.size() < 2) {
         return true;
@@ -129,6 +157,47 @@ bool mcmc_moves<Space>::AreWeightsUniform() const
     return true;
 }
 
+/// The table is built by the method of Vose (1991): columns whose scaled weight falls short of one are filled from
+/// those whose scaled weight exceeds it.
+template <typename Space, typename Rng>
+void mcmc_moves<Space, Rng>::BuildAliasTable()
+{
+    const unsigned k = weights.size();
+    alias_probability.assign(k, 1.0);
+    alias.resize(k);
+
+    double total = 0.0;
+    for(unsigned i = 0; i < k; i++)
+        total += weights[i];
+
+    std::vector<unsigned> small, large;
+    for(unsigned i = 0; i < k; i++) {
+        alias[i] = i;
+        alias_probability[i] = weights[i] * k / total;
+        if(alias_probability[i] < 1.0)
+            small.push_back(i);
+        else
+            large.push_back(i);
+    }
+
+    while(!small.empty() && !large.empty()) {
+        unsigned s = small.back(), l = large.back();
+        small.pop_back();
+        alias[s] = l;
+        alias_probability[l] -= 1.0 - alias_probability[s];
+        if(alias_probability[l] < 1.0) {
+            large.pop_back();
+            small.push_back(l);
+        }
+    }
+
+    // Any columns left over differ from one only by rounding error.
+    for(size_t i = 0; i < small.size(); i++)
+        alias_probability[small[i]] = 1.0;
+    for(size_t i = 0; i < large.size(); i++)
+        alias_probability[large[i]] = 1.0;
+}
+
 } // namespace smc
 
 #endif
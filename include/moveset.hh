@@ -29,6 +29,7 @@
 
 #include "mcmc.hh"
 #include "particle.hh"
+#include <algorithm>
 #include <cassert>
 #include <functional>
 #include <vector>
@@ -38,13 +39,15 @@ namespace smc
 {
 /// A template class for a set of moves for use in an SMC samplers framework.
 
-template <class Space> class moveset
+template <class Space, class Rng = rng> class moveset
 {
 public:
     /// Callbacks used
-    typedef std::function<particle<Space>(rng*)> init_fn;
-    typedef std::function<long(long, const particle<Space>&, rng*)> move_select_fn;
-    typedef std::function<void(long, particle<Space>&, rng*)> move_fn;
+    typedef std::function<particle<Space>(Rng*)> init_fn;
+    typedef std::function<long(long, const particle<Space>&, Rng*)> move_select_fn;
+    typedef std::function<void(long, particle<Space>&, Rng*)> move_fn;
+    typedef std::function<void(long, particle<Space>*, long, Rng*)> move_block_fn;
+    typedef std::function<long(long, particle<Space>*, long, Rng*)> mcmc_block_fn;
 
 private:
     ///The function which initialises a particle.
@@ -54,9 +57,13 @@ private:
     ///The functions which perform actual moves.
     std::vector<move_fn> pfMoves;
     ///The Markov Chain Monte Carlo moves to use.
-    mcmc_moves<Space> pfMCMC;
+    mcmc_moves<Space, Rng> pfMCMC;
     ///Number of MCMC moves to make
     std::size_t nMCMC;
+    ///The function, if any, which moves a contiguous range of particles.
+    move_block_fn pfMoveBlock;
+    ///The function, if any, which applies the MCMC moves to a contiguous range of particles.
+    mcmc_block_fn pfMCMCBlock;
 
 public:
     ///Create a completely unspecified moveset
@@ -67,14 +74,28 @@ public:
     ///Create a fully specified moveset
     moveset(init_fn pfInit, move_select_fn pfMoveSelect,
             std::vector<move_fn> pfNewMoves,
-            mcmc_moves<Space> selector);
+            mcmc_moves<Space, Rng> selector);
 
     ///Initialise a particle
-    particle<Space> DoInit(rng * pRng) { return pfInitialise(pRng);};
+    particle<Space> DoInit(Rng * pRng) { return pfInitialise(pRng);};
     ///Perform an MCMC move on a particle
-    int DoMCMC(long lTime, particle<Space> & pFrom, rng* pRng);
+    int DoMCMC(long lTime, particle<Space> & pFrom, Rng* pRng);
     ///Select an appropriate move at time lTime and apply it to pFrom
-    void DoMove(long lTime, particle<Space> & pFrom, rng * pRng);
+    void DoMove(long lTime, particle<Space> & pFrom, Rng * pRng);
+    ///Returns the number of moves from which the move selection function chooses.
+    long GetNumberOfMoves(void) const { return pfMoves.size(); }
+    ///Returns the index of the move which should be applied to pFrom at time lTime
+    long DoSelect(long lTime, const particle<Space> & pFrom, Rng* pRng) { return pfMoves.size() > 1 ? pfMoveSelect(lTime, pFrom, pRng) : 0; }
+    ///Apply move lMove to pFrom at time lTime
+    void DoMoveNumber(long lMove, long lTime, particle<Space> & pFrom, Rng* pRng) { pfMoves[lMove](lTime, pFrom, pRng); }
+    ///Returns true if a function which moves a range of particles has been set.
+    bool HasMoveBlock(void) const { return static_cast<bool>(pfMoveBlock); }
+    ///Returns true if a function which applies the MCMC moves to a range of particles has been set.
+    bool HasMCMCBlock(void) const { return static_cast<bool>(pfMCMCBlock); }
+    ///Move the n particles starting at pFirst at time lTime
+    void DoMoveBlock(long lTime, particle<Space>* pFirst, long n, Rng* pRng) { pfMoveBlock(lTime, pFirst, n, pRng); }
+    ///Apply the MCMC moves to the n particles starting at pFirst; returns the number of particles which moved
+    long DoMCMCBlock(long lTime, particle<Space>* pFirst, long n, Rng* pRng) { return pfMCMCBlock(lTime, pFirst, n, pRng); }
 
     ///Free the memory used for the array of move pointers when deleting
     ~moveset();
@@ -86,7 +107,7 @@ public:
 
     /// \brief Set the MCMC function, sets the number of moves to pfNewMCMC.Count()
     /// \param pfNewMCMC  The function which performs an MCMC move
-    void SetMCMCSelector(mcmc_moves<Space> pfNewMCMC)
+    void SetMCMCSelector(mcmc_moves<Space, Rng> pfNewMCMC)
     { pfMCMC = pfNewMCMC; SetNumberOfMCMCMoves(pfNewMCMC.Count()); }
 
     /// \brief Set the number of MCMC moves to make
@@ -102,15 +123,28 @@ public:
     ///Set the individual move functions to the supplied array of such functions
     void SetMoveFunctions(const std::vector<move_fn>& moves);
 
-    ///Moveset assignment should allocate buffers and deep copy all members.
-    moveset<Space> & operator= (moveset<Space> & pFrom);
+    /// \brief Set a function which moves a contiguous range of particles in a single call.
+    /// \param pfNewMoveBlock moves the n particles starting at its second argument at the specified time, using the
+    /// supplied random number generator for all of them; it is used in place of the move selection and move functions
+    void SetMoveBlockFunction(move_block_fn pfNewMoveBlock)
+    { pfMoveBlock = pfNewMoveBlock; }
+    /// \brief Set a function which applies the MCMC moves to a contiguous range of particles in a single call.
+    /// \param pfNewMCMCBlock applies the MCMC moves to the n particles starting at its second argument and returns
+    /// the number of particles for which a move was accepted; it is used in place of the MCMC selector
+    void SetMCMCBlockFunction(mcmc_block_fn pfNewMCMCBlock)
+    { pfMCMCBlock = pfNewMCMCBlock; }
+
+    ///Copy every function and the number of MCMC moves of pFrom.
+    moveset(const moveset<Space, Rng> & pFrom) = default;
+    ///Copy every function and the number of MCMC moves of pFrom.
+    moveset<Space, Rng> & operator= (const moveset<Space, Rng> & pFrom) = default;
 };
 
 
 /// The argument free smc::moveset constructor simply sets the number of available moves to zero and sets
 /// all of the associated function pointers to NULL.
-template <class Space>
-moveset<Space>::moveset() :
+template <class Space, class Rng>
+moveset<Space, Rng>::moveset() :
     pfInitialise(nullptr),
     pfMoveSelect(nullptr),
     nMCMC(0)
@@ -121,8 +155,8 @@ moveset<Space>::moveset() :
 /// pointers to the supplied values.
 /// \param pfInit The function which should be used to initialise particles when the system is initialised
 /// \param pfNewMoves An functions which moves a particle at a specified time to a new location
-template <class Space>
-moveset<Space>::moveset(init_fn pfInit,
+template <class Space, class Rng>
+moveset<Space, Rng>::moveset(init_fn pfInit,
                         move_fn newMoves) :
     nMCMC(0)
 {
@@ -139,9 +173,9 @@ moveset<Space>::moveset(init_fn pfInit,
 /// \param nMoves The number of moves which are defined in general
 /// \param pfNewMoves An array of functions which move a particle at a specified time to a new location
 /// \param selector The function which should be called to apply an MCMC move (if any)
-template <class Space>
-moveset<Space>::moveset(init_fn pfInit, move_select_fn pfMoveSelector, std::vector<move_fn> pfNewMoves,
-                        mcmc_moves<Space> selector)
+template <class Space, class Rng>
+moveset<Space, Rng>::moveset(init_fn pfInit, move_select_fn pfMoveSelector, std::vector<move_fn> pfNewMoves,
+                        mcmc_moves<Space, Rng> selector)
     : nMCMC(selector.Count())
 {
     SetInitialisor(pfInit);
@@ -150,27 +184,31 @@ moveset<Space>::moveset(init_fn pfInit, move_select_fn pfMoveSelector, std::vect
     SetMCMCSelector(selector);
 }
 
-template <class Space>
-moveset<Space>::~moveset()
+template <class Space, class Rng>
+moveset<Space, Rng>::~moveset()
 {
 }
 
-template <class Space>
-int moveset<Space>::DoMCMC(long lTime, particle<Space> & pFrom, rng *pRng)
+template <class Space, class Rng>
+int moveset<Space, Rng>::DoMCMC(long lTime, particle<Space> & pFrom, Rng *pRng)
 {
     assert(pfMCMC.Count() > 0 || nMCMC == 0);
     bool any_accepted = false;
-    auto moves = pfMCMC.SelectMoves(pRng, nMCMC);
-    assert(moves.size() == nMCMC);
-    for(auto move_fn : moves) {
-        if((*move_fn)(lTime, pFrom, pRng))
-            any_accepted = true;
+    //The moves are selected a few at a time into a buffer on the stack, so that no allocation is needed.
+    typename mcmc_moves<Space, Rng>::mcmc_fn* moves[SMC_MCMC_SELECT_BUFFER];
+    for(size_t done = 0; done < nMCMC; done += SMC_MCMC_SELECT_BUFFER) {
+        unsigned n = std::min<size_t>(nMCMC - done, SMC_MCMC_SELECT_BUFFER);
+        pfMCMC.SelectMoves(pRng, n, moves);
+        for(unsigned i = 0; i < n; i++) {
+            if((*moves[i])(lTime, pFrom, pRng))
+                any_accepted = true;
+        }
     }
     return any_accepted;
 }
 
-template <class Space>
-void moveset<Space>::DoMove(long lTime, particle<Space> & pFrom, rng *pRng)
+template <class Space, class Rng>
+void moveset<Space, Rng>::DoMove(long lTime, particle<Space> & pFrom, Rng *pRng)
 {
     if(pfMoves.size() > 1)
         pfMoves[pfMoveSelect(lTime, pFrom, pRng)](lTime, pFrom, pRng);
@@ -184,23 +222,11 @@ void moveset<Space>::DoMove(long lTime, particle<Space> & pFrom, rng *pRng)
 /// The move functions accept two arguments, the first of which corresponds to the system evolution time and the
 /// second to an initial particle position and the second to a weighted starting position. It returns a new
 /// weighted position corresponding to the moved particle.
-template <class Space>
-void moveset<Space>::SetMoveFunctions(const std::vector<move_fn>& newMoves)
+template <class Space, class Rng>
+void moveset<Space, Rng>::SetMoveFunctions(const std::vector<move_fn>& newMoves)
 {
     pfMoves = std::vector<move_fn>(newMoves.begin(), newMoves.end());
     return;
 }
-
-template <class Space>
-moveset<Space> & moveset<Space>::operator= (moveset<Space> & pFrom)
-{
-    SetInitialisor(pFrom.pfInitialise);
-    SetMCMCSelector(pFrom.pfMCMC);
-    SetNumberOfMCMCMoves(pFrom.nMCMC);
-    SetMoveSelectionFunction(pFrom.pfMoveSelect);
-    SetMoveFunctions(pFrom.pfMoves);
-
-    return *this;
-}
 }
 #endif
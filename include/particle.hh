@@ -21,23 +21,140 @@
 //! \file
 //! \brief Class used to store and manipulate a single particle.
 //!
-//! This file contains the smc::particle class which is used internally and passed to move functions.
+//! This file contains the smc::particle class which is used internally and passed to move functions, the
+//! smc::shared_values trait which allows the particles to share copies of their values and the smc::serialiser trait
+//! which allows their values to be stored on disk.
 
 #ifndef __SMC_PARTICLE_HH
 #define __SMC_PARTICLE_HH 1.0
 
 #include <float.h>
+#include <atomic>
+#include <cstring>
 #include <limits>
 #include <cmath>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 namespace smc
 {
+/// A trait which may be specialised, deriving from std::true_type, to make particles share their values.
+
+///    The values of particles whose Space has this trait are held through reference-counted handles. Copying such a
+///    particle, as resampling and the history do, copies only the handle, and the value is cloned the first time one
+///    of the particles which share it is given a new value or a pointer through which it may be modified. This makes
+///    resampling cheap when Space is expensive to copy, at the cost of an allocation whenever a particle is first
+///    changed after it has been copied.
+template <class Space> struct shared_values : std::false_type {};
+
+/// The base of the serialiser of a type which cannot be stored on disk.
+struct no_serialiser {
+    template <class Space> static void Write(const Space &, std::vector<char> &) {}
+    template <class Space> static void Read(const char*, size_t, Space &) {}
+};
+
+/// A trait which may be specialised to allow values of type Space to be stored in a history on disk.
+
+///    A specialisation provides static functions Write(const Space & sValue, std::vector<char> & Bytes), which
+///    appends the bytes representing sValue to Bytes, and Read(const char* pBytes, size_t uBytes, Space & sValue),
+///    which sets sValue to the value represented by the uBytes bytes at pBytes. Trivially copyable types are stored as
+///    their raw bytes unless the trait is specialised for them.
+template <class Space, class Enable = void> struct serialiser : no_serialiser {};
+
+/// The serialiser of a trivially copyable type, which stores its raw bytes.
+template <class Space>
+struct serialiser<Space, typename std::enable_if<std::is_trivially_copyable<Space>::value>::type> {
+    static void Write(const Space & sValue, std::vector<char> & Bytes)
+    {
+        const char* pBytes = reinterpret_cast<const char*>(&sValue);
+        Bytes.insert(Bytes.end(), pBytes, pBytes + sizeof(Space));
+    }
+    static void Read(const char* pBytes, size_t, Space & sValue)
+    { std::memcpy(static_cast<void*>(&sValue), pBytes, sizeof(Space)); }
+};
+
+/// Whether values of type Space can be stored on disk, by default or through a specialisation of smc::serialiser.
+template <class Space> struct has_serialiser :
+    std::integral_constant<bool, !std::is_base_of<no_serialiser, serialiser<Space> >::value> {};
+
+/// The storage of the value of a particle, which holds the value itself unless shared_values<Space> is set.
+template <class Space, bool bShared = shared_values<Space>::value> class particle_value
+{
+private:
+    Space value;
+
+public:
+    /// Returns the value
+    Space const & Get(void) const { return value; }
+    /// Returns a pointer through which the value may be modified
+    Space* GetWritable(void) { return &value; }
+    /// Sets the value
+    void Set(const Space & sValue) { value = sValue; }
+    /// Sets the value, moving it from sValue
+    void Set(Space && sValue) { value = std::move(sValue); }
+    /// Constructs the value in place from the supplied arguments
+    template <class... Args> void Emplace(Args&&... args) { value = Space(std::forward<Args>(args)...); }
+};
+
+/// The storage of the value of a particle which shares its value with its copies.
+template <class Space> class particle_value<Space, true>
+{
+private:
+    ///The value, which is shared by every copy of the particle until one of them is changed.
+    std::shared_ptr<Space> pValue;
+
+    ///Returns a default constructed value, which stands for the value of a particle which has not been set.
+    static Space const & GetEmpty(void) { static const Space sEmpty = Space(); return sEmpty; }
+    ///Returns true if no other particle shares the value.
+    bool IsUnique(void) const
+    {
+        if(pValue.use_count() != 1)
+            return false;
+        //Order any reads of the value by the copies which have since released it before our writes.
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return true;
+    }
+
+public:
+    /// Returns the value
+    Space const & Get(void) const { return pValue ? *pValue : GetEmpty(); }
+    /// Returns a pointer through which the value may be modified, cloning the value first if it is shared
+    Space* GetWritable(void)
+    {
+        if(!pValue)
+            pValue = std::make_shared<Space>();
+        else if(!IsUnique())
+            pValue = std::make_shared<Space>(*pValue);
+        return pValue.get();
+    }
+    /// Sets the value, in place unless it is shared
+    void Set(const Space & sValue)
+    {
+        if(pValue && IsUnique())
+            *pValue = sValue;
+        else
+            pValue = std::make_shared<Space>(sValue);
+    }
+    /// Sets the value, moving it from sValue
+    void Set(Space && sValue)
+    {
+        if(pValue && IsUnique())
+            *pValue = std::move(sValue);
+        else
+            pValue = std::make_shared<Space>(std::move(sValue));
+    }
+    /// Constructs a new value, which is not shared, from the supplied arguments
+    template <class... Args> void Emplace(Args&&... args) { pValue = std::make_shared<Space>(std::forward<Args>(args)...); }
+};
+
 /// A template class for the particles of an SMC algorithm
 template <class Space> class particle
 {
 private:
     /// Value of this particle
-    Space    value;
+    particle_value<Space> value;
     /// Natural logarithm of this particle's weight.
     double   logweight;
 
@@ -47,15 +164,19 @@ public:
     particle(Space sInit, double dLogWeight);
     /// The copy constructor performs a shallow copy.
     particle(const particle<Space> & pFrom);
+    /// The move constructor takes the value of pFrom, leaving it in a valid but unspecified state.
+    particle(particle<Space> && pFrom) = default;
     /// The assignment operator performs a shallow copy.
     particle<Space> & operator= (const particle<Space> & pFrom);
+    /// The move assignment operator takes the value of pFrom, leaving it in a valid but unspecified state.
+    particle<Space> & operator= (particle<Space> && pFrom) = default;
 
     ~particle();
 
     /// Returns the particle's value
-    Space const & GetValue(void) const {return value;}
+    Space const & GetValue(void) const {return value.Get();}
     /// Returns a pointer to the value to allow for more efficient changes
-    Space* GetValuePointer(void) {return &value;}
+    Space* GetValuePointer(void) {return value.GetWritable();}
     /// Returns the particle's log weight.
     double GetLogWeight(void) const {return logweight;}
     /// Returns the particle's unnormalised weight.
@@ -65,11 +186,19 @@ public:
     ///
     /// \param sValue The particle value to use
     /// \param dLogWeight The natural logarithm of the new particle weight
-    void Set(Space sValue, double dLogWeight) {value = sValue; logweight = dLogWeight;}
+    void Set(Space sValue, double dLogWeight) {value.Set(std::move(sValue)); logweight = dLogWeight;}
     /// \brief Sets the particle's value explicitly
     ///
     /// \param sValue The particle value to use
-    void SetValue(const Space & sValue) {value = sValue;}
+    void SetValue(const Space & sValue) {value.Set(sValue);}
+    /// \brief Sets the particle's value, moving it from sValue
+    ///
+    /// \param sValue The particle value to use
+    void SetValue(Space && sValue) {value.Set(std::move(sValue));}
+    /// \brief Constructs the particle's value in place
+    ///
+    /// \param args The arguments which are passed to the constructor of Space
+    template <class... Args> void EmplaceValue(Args&&... args) {value.Emplace(std::forward<Args>(args)...);}
     /// \brief Sets the particle's log weight explicitly
     ///
     /// \param dLogWeight The natural logarithm of the new particle weight
@@ -111,7 +240,7 @@ particle<Space>::particle(const particle<Space> & pFrom)
 template <class Space>
 particle<Space>::particle(Space sInit, double dLogWeight)
 {
-    value = sInit;
+    value.Set(std::move(sInit));
     logweight = dLogWeight;
 }
 
@@ -0,0 +1,217 @@
+//   SMCTC: population.hh
+//
+//   This file is part of SMCTC.
+//
+//   SMCTC is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   SMCTC is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with SMCTC.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+//! \file
+//! \brief Class used to store the particles of a sampler.
+//!
+//! This file contains the smc::population class, which stores the values of a particle set separately from a
+//! contiguous array of their log weights, and the smc::aligned_allocator used for that array.
+
+#ifndef __SMC_POPULATION_HH
+#define __SMC_POPULATION_HH 1.0
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <iterator>
+#include <limits>
+#include <new>
+#include <utility>
+#include <vector>
+
+#include "particle.hh"
+
+#ifndef SMC_ALIGNMENT
+///The alignment, in bytes, of the arrays of weights used by the library: a cache line, and a multiple of the widest
+///vector registers in common use.
+#define SMC_ALIGNMENT 64
+#endif
+
+namespace smc
+{
+/// An allocator which aligns the arrays it allocates to SMC_ALIGNMENT bytes.
+template <class T> class aligned_allocator
+{
+public:
+    typedef T value_type;
+
+    aligned_allocator() {}
+    template <class U> aligned_allocator(const aligned_allocator<U> &) {}
+
+    ///Allocate space for n objects; the address of the underlying block is stored immediately before the array.
+    T* allocate(std::size_t n)
+    {
+        void* pBlock = std::malloc(n * sizeof(T) + SMC_ALIGNMENT + sizeof(void*));
+        if(!pBlock)
+            throw std::bad_alloc();
+        std::uintptr_t lAddress = reinterpret_cast<std::uintptr_t>(pBlock) + sizeof(void*);
+        lAddress = (lAddress + SMC_ALIGNMENT - 1) & ~(std::uintptr_t)(SMC_ALIGNMENT - 1);
+        reinterpret_cast<void**>(lAddress)[-1] = pBlock;
+        return reinterpret_cast<T*>(lAddress);
+    }
+    ///Free an array obtained from allocate.
+    void deallocate(T* p, std::size_t)
+    {
+        if(p)
+            std::free(reinterpret_cast<void**>(p)[-1]);
+    }
+
+    template <class U> struct rebind { typedef aligned_allocator<U> other; };
+};
+
+template <class T, class U>
+bool operator==(const aligned_allocator<T> &, const aligned_allocator<U> &) { return true; }
+template <class T, class U>
+bool operator!=(const aligned_allocator<T> &, const aligned_allocator<U> &) { return false; }
+
+/// A template class for the particle set of an SMC algorithm.
+
+///    The log weights of the particles are held in a contiguous, aligned array of their own so that the operations
+///    which only involve the weights (normalisation, the effective sample size, resampling) read a single dense
+///    stream of doubles. The values are held in an array of smc::particle objects, each of which can be handed to
+///    user-supplied functions which expect a particle: Checkout copies the particle's log weight into it, and Checkin
+///    copies the (possibly modified) log weight back. At other times the log weight within those objects is stale.
+template <class Space> class population
+{
+private:
+    ///The values of the particles.
+    std::vector<particle<Space> > pValues;
+    ///The natural logarithms of the particle weights.
+    std::vector<double, aligned_allocator<double> > dLogWeights;
+
+public:
+    ///Create an empty population.
+    population() {}
+    ///Create a population of lSize particles with undefined values and weight NAN.
+    explicit population(long lSize) :
+        pValues(lSize), dLogWeights(lSize, std::numeric_limits<double>::quiet_NaN()) {}
+
+    ///Returns the number of particles.
+    long size(void) const { return pValues.size(); }
+    ///Returns true if the population contains no particles.
+    bool empty(void) const { return pValues.empty(); }
+    ///Change the number of particles; any new particles have undefined values and weight NAN.
+    void resize(long lSize)
+    { pValues.resize(lSize); dLogWeights.resize(lSize, std::numeric_limits<double>::quiet_NaN()); }
+    ///Reserve storage for lSize particles.
+    void reserve(long lSize) { pValues.reserve(lSize); dLogWeights.reserve(lSize); }
+    ///Remove every particle.
+    void clear(void) { pValues.clear(); dLogWeights.clear(); }
+    ///Exchange the particles of this population with those of pOther.
+    void swap(population<Space> & pOther) { pValues.swap(pOther.pValues); dLogWeights.swap(pOther.dLogWeights); }
+
+    ///Returns the value of particle n.
+    const Space & GetValue(long n) const { return pValues[n].GetValue(); }
+    ///Returns a pointer to the value of particle n to allow for more efficient changes.
+    Space* GetValuePointer(long n) { return pValues[n].GetValuePointer(); }
+    ///Returns the log weight of particle n.
+    double GetLogWeight(long n) const { return dLogWeights[n]; }
+    ///Returns the unnormalised weight of particle n.
+    double GetWeight(long n) const { return exp(dLogWeights[n]); }
+    ///Returns the contiguous array of log weights.
+    double* GetLogWeights(void) { return dLogWeights.data(); }
+    ///Returns the contiguous array of log weights.
+    const double* GetLogWeights(void) const { return dLogWeights.data(); }
+    ///Returns a copy of particle n, which shares its value with particle n if the values are shared.
+    particle<Space> GetParticle(long n) const
+    { particle<Space> pCopy(pValues[n]); pCopy.SetLogWeight(dLogWeights[n]); return pCopy; }
+
+    ///Sets the value of particle n.
+    void SetValue(long n, const Space & sValue) { pValues[n].SetValue(sValue); }
+    ///Sets the value of particle n to that of particle lFrom, sharing it if the values are shared.
+    void CopyValue(long n, long lFrom) { pValues[n] = pValues[lFrom]; }
+    ///Sets the value of particle n to that of particle lFrom of pFrom, sharing it if the values are shared.
+    void CopyValue(long n, const population<Space> & pFrom, long lFrom) { pValues[n] = pFrom.pValues[lFrom]; }
+    ///Sets the log weight of particle n.
+    void SetLogWeight(long n, double dLogWeight) { dLogWeights[n] = dLogWeight; }
+    ///Sets the value and log weight of particle n to those of pFrom.
+    void Set(long n, const particle<Space> & pFrom) { pValues[n] = pFrom; dLogWeights[n] = pFrom.GetLogWeight(); }
+    ///Sets the value and log weight of particle n to those of pFrom, moving the value.
+    void Set(long n, particle<Space> && pFrom) { dLogWeights[n] = pFrom.GetLogWeight(); pValues[n] = std::move(pFrom); }
+    ///Append a particle to the population.
+    void Append(const particle<Space> & pFrom) { pValues.push_back(pFrom); dLogWeights.push_back(pFrom.GetLogWeight()); }
+    ///Append a particle to the population, moving its value.
+    void Append(particle<Space> && pFrom) { dLogWeights.push_back(pFrom.GetLogWeight()); pValues.push_back(std::move(pFrom)); }
+    ///Append the particles of another population to this one.
+    void Append(const population<Space> & pFrom)
+    {
+        pValues.insert(pValues.end(), pFrom.pValues.begin(), pFrom.pValues.end());
+        dLogWeights.insert(dLogWeights.end(), pFrom.dLogWeights.begin(), pFrom.dLogWeights.end());
+    }
+    ///Append the particles of another population to this one, moving their values.
+    void Append(population<Space> && pFrom)
+    {
+        pValues.insert(pValues.end(), std::make_move_iterator(pFrom.pValues.begin()), std::make_move_iterator(pFrom.pValues.end()));
+        dLogWeights.insert(dLogWeights.end(), pFrom.dLogWeights.begin(), pFrom.dLogWeights.end());
+        pFrom.clear();
+    }
+    ///Returns particle n, moving its value out of the population; the value of particle n is left unspecified.
+    particle<Space> Release(long n)
+    { particle<Space> pOut(std::move(pValues[n])); pOut.SetLogWeight(dLogWeights[n]); return pOut; }
+
+    ///Returns particle n, with its log weight, for use by a function which expects a particle.
+    particle<Space> & Checkout(long n) { pValues[n].SetLogWeight(dLogWeights[n]); return pValues[n]; }
+    ///Record the log weight of particle n after it has been returned by Checkout; returns true if it has changed.
+    bool Checkin(long n)
+    {
+        double dLogWeight = pValues[n].GetLogWeight();
+        bool bChanged = !(dLogWeight == dLogWeights[n]);
+        dLogWeights[n] = dLogWeight;
+        return bChanged;
+    }
+
+    ///Returns particles lStart to lEnd - 1, with their log weights, for use by a function which expects a range of particles.
+    particle<Space>* CheckoutRange(long lStart, long lEnd)
+    {
+        for(long i = lStart; i < lEnd; ++i)
+            pValues[i].SetLogWeight(dLogWeights[i]);
+        return pValues.data() + lStart;
+    }
+    ///Record the log weights of the range returned by CheckoutRange; returns true if any has changed.
+    bool CheckinRange(long lStart, long lEnd)
+    {
+        bool bChanged = false;
+        for(long i = lStart; i < lEnd; ++i)
+            bChanged = Checkin(i) || bChanged;
+        return bChanged;
+    }
+
+    ///Returns the particles as a contiguous array in which every log weight is up to date.
+    particle<Space>* GetParticles(void);
+    ///Record the log weights of the array returned by GetParticles after it has been modified.
+    void UpdateLogWeights(void);
+};
+
+template <class Space>
+particle<Space>* population<Space>::GetParticles(void)
+{
+    for(long i = 0; i < size(); ++i)
+        pValues[i].SetLogWeight(dLogWeights[i]);
+    return pValues.data();
+}
+
+template <class Space>
+void population<Space>::UpdateLogWeights(void)
+{
+    for(long i = 0; i < size(); ++i)
+        dLogWeights[i] = pValues[i].GetLogWeight();
+}
+}
+
+#endif
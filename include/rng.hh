@@ -23,10 +23,14 @@
 //!
 //! This file contains the definitions for the smc::rng and smc::rnginfo class.
 //! It wraps the random number generation facilities provided by the GSL and provides a convenient interfaces to access several of its more commonly-used features.
+//! It also provides a counter-based generator which allows independent streams to be addressed directly.
 
 #ifndef __SMC_RNG_HH
 #define __SMC_RNG_HH 1.0
 
+#include <cmath>
+#include <cstddef>
+
 extern "C" {
 #include <gsl/gsl_randist.h>
 #include <gsl/gsl_rng.h>
@@ -63,6 +67,32 @@ public:
 ///The global application instance of the gslrnginfo class:
 extern gslrnginfo rngset;
 
+///The counter-based Philox4x32-10 generator of Salmon et al. (2011) presented as a GSL generator type.
+
+///    Its state is a key, set from the seed, and a counter. Any stream may be reached in constant time by
+///    setting the counter with rng::SetStream, which makes it suitable for giving each particle its own stream.
+extern const gsl_rng_type* rng_philox4x32;
+
+///Transform uniform variates into normal variates using the Box-Muller method.
+
+///    On entry pX holds 2n uniform variates on [0,1); on exit it holds 2n independent normal variates with mean dMean
+///    and standard deviation dStd. The first and second halves of the array supply the radii and angles respectively, so
+///    that the loop works on contiguous data and can be vectorised.
+inline void BoxMuller(double* pX, size_t n, double dMean, double dStd)
+{
+    const double dTwoPi = 6.283185307179586477;
+    double* pU = pX;
+    double* pV = pX + n;
+
+    #pragma omp simd
+    for(size_t i = 0; i < n; i++) {
+        double dRadius = dStd * std::sqrt(-2.0 * std::log(1.0 - pU[i]));
+        double dAngle = dTwoPi * pV[i];
+        pU[i] = dMean + dRadius * std::cos(dAngle);
+        pV[i] = dMean + dRadius * std::sin(dAngle);
+    }
+}
+
 ///A random number generator class.
 
 ///    At present this serves as a wrapper for the gsl random number generation code.
@@ -85,6 +115,10 @@ public:
     ///Free the workspace allocated for random number generation
     ~rng();
 
+    ///Allocate a counter-based generator keyed by lSeed whose streams may be selected using SetStream
+    static rng* NewStream(unsigned long lSeed);
+    ///Position a counter-based generator at the start of the specified stream and substream
+    void SetStream(unsigned long lStream, unsigned long lSubstream);
 
     ///Provide access to the raw random number generator
     gsl_rng* GetRaw(void);
@@ -120,6 +154,17 @@ public:
     double Uniform(double dMin, double dMax);
     ///Returns a random number generated from the standard uniform[0,1) distribution
     double UniformS(void);
+
+    ///Fill pOut with n random numbers generated from an exponential distribution with the specified mean.
+    void ExponentialBatch(double* pOut, size_t n, double dMean);
+    ///Fill pOut with n random numbers generated from a normal distribution with a specified mean and standard deviation
+    void NormalBatch(double* pOut, size_t n, double dMean, double dStd);
+    ///Fill pOut with n random numbers generated uniformly between dMin and dMax
+    void UniformBatch(double* pOut, size_t n, double dMin, double dMax);
+
+private:
+    ///Fill pOut with n random numbers from the standard uniform[0,1) distribution.
+    void FillUniformS(double* pOut, size_t n);
 };
 }
 
@@ -30,25 +30,40 @@
 #include <cstdlib>
 #include <iosfwd>
 #include <memory>
+#include <string>
 #include <utility>
 #include <vector>
 
-#ifdef SMCTC_HAVE_BGL
-#include <boost/graph/adjacency_list.hpp>
-#include <boost/graph/labeled_graph.hpp>
-#include <boost/graph/graphviz.hpp>
-#endif
-
 #include "rng.hh"
+#include "ancestry.hh"
+#include "arena.hh"
+#include "diskhistory.hh"
+#include "genealogy.hh"
 #include "history.hh"
 #include "moveset.hh"
+#include "staticmoveset.hh"
 #include "particle.hh"
+#include "population.hh"
 #include "smc-exception.hh"
+#include "weights.hh"
 
 #if defined(_OPENMP)
 #include <omp.h>
 #endif
 
+#if defined(SMCTC_HAVE_BGL) && !defined(SMCTC_GENEALOGY)
+///The genealogy was formerly recorded, using the Boost Graph Library, when SMCTC_HAVE_BGL was defined.
+#define SMCTC_GENEALOGY 1
+#endif
+
+#ifndef SMC_BLOCK_SIZE
+///The number of elements handled by each block of the blocked parallel loops.
+///
+///Work which consumes random numbers or combines floating point values is divided into blocks of this fixed size,
+///rather than into one piece per thread, so that the results do not depend upon the number of threads.
+#define SMC_BLOCK_SIZE 4096
+#endif
+
 ///Specifiers for various resampling algorithms:
 enum ResampleType { SMC_RESAMPLE_MULTINOMIAL = 0,
                     SMC_RESAMPLE_RESIDUAL,
@@ -59,7 +74,9 @@ enum ResampleType { SMC_RESAMPLE_MULTINOMIAL = 0,
 
 ///Storage types for the history of the particle system.
 enum HistoryType { SMC_HISTORY_NONE = 0,
-                   SMC_HISTORY_RAM
+                   SMC_HISTORY_RAM,
+                   SMC_HISTORY_ANCESTRY,
+                   SMC_HISTORY_DISK
                  };
 
 namespace smc
@@ -74,12 +91,22 @@ struct DatabaseHistory {
 };
 
 /// A template class for an interacting particle system suitable for SMC sampling
-template <class Space>
+///
+/// \tparam Space The class used to represent a point in the sample space.
+/// \tparam Rng The random number generator class: smc::rng (the default) or smc::fastrng.
+/// \tparam Moveset The class of the set of moves: smc::moveset (the default) or an smc::static_moveset.
+template <class Space, class Rng = rng, class Moveset = moveset<Space, Rng> >
 class sampler
 {
 private:
     ///A random number generator.
-    std::unique_ptr<rng> pRng;
+    std::unique_ptr<Rng> pRng;
+    ///The key shared by the per-particle random number streams.
+    unsigned long lStreamSeed;
+    ///One counter-based random number generator for each thread, used within the parallel loops.
+    std::vector<std::unique_ptr<Rng> > pStreams;
+    ///One scratch arena for each thread, made current while the thread calls the moveset; the first is also used outside the parallel regions.
+    std::vector<std::unique_ptr<arena> > pArenas;
 
     ///Number of particles in the system.
     long N;
@@ -96,11 +123,41 @@ private:
     std::vector<unsigned int> uRSCount;
     ///Structure used internally for resampling.
     std::vector<unsigned int> uRSIndices;
+    ///Structure used internally for resampling.
+    std::vector<double> dRSUniforms;
+    ///Structure used internally for resampling.
+    std::vector<double> dRSSpacings;
+    ///Structure used internally for resampling.
+    std::vector<double> dRSCumulative;
+    ///Structure used internally for resampling.
+    std::vector<unsigned int> uRSFree;
 
     ///The particles within the system.
-    std::vector<particle<Space>> pParticles;
+    population<Space> pParticles;
+    ///Whether resampling gathers the particles into a second population rather than replicating them in place.
+    bool bDoubleBuffer;
+    ///The population into which the particles are gathered when resampling is double buffered.
+    population<Space> pSpare;
+    ///The largest number of particles which IterateEssVariable may generate in one iteration.
+    long lMaxParticles;
+    ///The normalised weights of the particles; valid only while bWeightsCurrent is set.
+    mutable std::vector<double, aligned_allocator<double> > dNormalisedWeights;
+    ///The natural logarithm of the sum of the unnormalised weights; valid only while bWeightsCurrent is set.
+    mutable double dLogWeightSum;
+    ///Whether dNormalisedWeights and dLogWeightSum correspond to the current log weights.
+    mutable bool bWeightsCurrent;
+    ///The logarithm of the part of the normalising constant estimate which has been removed from the log weights.
+    double dLogNormaliser;
+    ///The value of dLogNormaliser at the start of each iteration, kept while the history is stored.
+    std::vector<double> dLogNormalisers;
     ///The set of moves available.
-    moveset<Space> Moves;
+    std::unique_ptr<Moveset> pMoves;
+    ///Whether the particles are grouped by the move selected for them before they are moved.
+    bool bGroupMoves;
+    ///The move selected for each particle when the moves are grouped.
+    std::vector<unsigned int> uMoveChoice;
+    ///The indices of the particles, ordered by the move selected for them, when the moves are grouped.
+    std::vector<unsigned int> uMoveOrder;
 
     ///The number of MCMC moves which have been accepted during this iteration
     int nAccepted;
@@ -111,21 +168,29 @@ private:
     HistoryType htHistoryMode;
     ///The historical process associated with the particle system.
     history<particle<Space> > History;
+    ///The surviving lineages of the particle system, stored in place of History in SMC_HISTORY_ANCESTRY mode.
+    ancestry<particle<Space> > Ancestry;
+    ///The history of the particle system, stored in a file in SMC_HISTORY_DISK mode.
+    diskhistory<Space> DiskHistory;
+    ///The index, within the most recently stored generation, of the ancestor of each particle.
+    std::vector<unsigned int> uAncestors;
+
+    /// A path sampling integral which is accumulated as the system evolves, without reference to its history.
+    struct pathsampling {
+        double(*pIntegrand)(long, const particle<Space>&, void*); //!< The quantity integrated at each time.
+        double(*pWidth)(long, void*);                              //!< The width of the path sampling grid.
+        void* pAuxiliary;                                          //!< Passed to both of the above functions.
+        std::vector<double> dTerms;                                //!< The contribution of each completed iteration.
+    };
+    ///The path sampling integrals registered with AddPathSampling.
+    std::vector<pathsampling> PathSamplers;
 #if defined(_OPENMP)
 	std::size_t nThreads;
 #endif
 
-#ifdef SMCTC_HAVE_BGL
-    /// A vertex in the particle history graph:
-    /// (generation, particle index)
-    typedef std::pair<size_t, size_t> Vertex;
-    /// Particle history graph
-    typedef boost::labeled_graph <
-    boost::adjacency_list< boost::vecS, boost::vecS, boost::directedS, size_t >,
-          Vertex
-          > Graph;
-
-    Graph g;
+#ifdef SMCTC_GENEALOGY
+    ///The surviving lineages of every particle, from time 0 to the present.
+    genealogy Genealogy;
 #endif
 
 public:
@@ -133,26 +198,42 @@ public:
     sampler(long lSize, HistoryType htHistoryMode);
     ///Create an particle system constaining lSize uninitialised particles with the specified mode and random number generator.
     sampler(long lSize, HistoryType htHistoryMode, const gsl_rng_type* rngType, unsigned long nSeed);
+    ///Create an particle system constaining lSize uninitialised particles with the specified mode which uses the supplied random number generator.
+    sampler(long lSize, HistoryType htHistoryMode, Rng* pNewRng);
     ///Dispose of a sampler.
     ~sampler();
     ///Calculates and Returns the Effective Sample Size.
     double GetESS(void) const;
     ///Returns a pointer to the History of the particle system
     const history<particle<Space> > * GetHistory(void) const { return &History; }
+    ///Returns a pointer to the surviving lineages of the particle system (SMC_HISTORY_ANCESTRY mode)
+    const ancestry<particle<Space> > * GetAncestry(void) const { return &Ancestry; }
+    ///Returns a pointer to the history of the particle system stored on disk (SMC_HISTORY_DISK mode)
+    const diskhistory<Space> * GetDiskHistory(void) const { return &DiskHistory; }
+    ///Reconstruct the path of particle n from the initial generation to the present (SMC_HISTORY_ANCESTRY mode).
+    void GetParticlePath(long n, std::vector<particle<Space> > & pPath) const;
     ///Returns the number of particles within the system.
     long GetNumber(void) const {return N;}
     ///Return the value of particle n
-    const Space &  GetParticleValue(int n) { return pParticles[n].GetValue(); }
+    const Space &  GetParticleValue(int n) { return pParticles.GetValue(n); }
     ///Return the logarithmic unnormalized weight of particle n
-    double GetParticleLogWeight(int n) { return pParticles[n].GetLogWeight(); }
+    double GetParticleLogWeight(int n) { return pParticles.GetLogWeight(n); }
     ///Return the unnormalized weight of particle n
-    double GetParticleWeight(int n) { return pParticles[n].GetWeight(); }
+    double GetParticleWeight(int n) { return pParticles.GetWeight(n); }
     ///Returns the current evolution time of the system.
     long GetTime(void) const {return T;}
+    ///Returns the natural logarithm of the current estimate of the normalising constant.
+    double GetLogNormalisingConstant(void) const { return dLogNormaliser + GetLogMeanWeight(); }
+    ///Register a path sampling integral to be accumulated at every iteration; returns its index.
+    long AddPathSampling(double(*pIntegrand)(long, const particle<Space>&, void*), double(*pWidth)(long, void*), void* pAuxiliary);
+    ///Returns the current value of the path sampling integral with the specified index.
+    double GetPathSampling(long lIndex = 0);
     ///Initialise the sampler and its constituent particles.
     void Initialise(void);
     ///Integrate the supplied function with respect to the current particle set.
     double Integrate(double(*pIntegrand)(const Space &, void*), void* pAuxiliary);
+    ///Obtain the means and, optionally, the variances of K statistics of the current particle set in a single pass.
+    template <class Statistics> void IntegrateMoments(long K, Statistics fStatistics, double* dMeans, double* dVariances = 0);
     ///Integrate the supplied function over the path path using the supplied width function.
     double IntegratePathSampling(double(*pIntegrand)(long, const particle<Space>&, void*), double(*pWidth)(long, void*), void* pAuxiliary);
     ///Perform one iteration of the simulation algorithm.
@@ -178,9 +259,17 @@ public:
     ///Resample the particle set using fribblebits resampling.
     void ResampleFribble(double dEss);
     ///Sets the entire moveset to the one which is supplied
-    void SetMoveSet(moveset<Space>& pNewMoveset) { Moves = pNewMoveset; }
+    void SetMoveSet(const Moveset & pNewMoveset) { pMoves.reset(new Moveset(pNewMoveset)); }
+    ///Set the file in which the history is stored in SMC_HISTORY_DISK mode; it is created when the sampler is initialised.
+    void SetHistoryFile(const std::string & sPath) { DiskHistory.SetPath(sPath); }
     ///Set Resampling Parameters
     void SetResampleParams(ResampleType rtMode, double dThreshold);
+    ///Select the moves of all of the particles first and then apply each move to the particles which selected it.
+    void SetMoveGrouping(bool bGroup) { bGroupMoves = bGroup; }
+    ///Resample by gathering the particles, in parallel, into a second population which then replaces the first.
+    void SetDoubleBuffering(bool bDouble) { bDoubleBuffer = bDouble; if(!bDouble) pSpare.clear(); }
+    ///Set the largest number of particles which IterateEssVariable may generate in one iteration.
+    void SetMaxParticles(long lMax);
     ///Dump a specified particle to the specified output stream in a human readable form
     std::ostream & StreamParticle(std::ostream & os, long n);
     ///Dump the entire particle set to the specified output stream in a human readable form
@@ -188,7 +277,13 @@ public:
     ///Allow a human readable version of the sampler configuration to be produced using the stream operator.
     /// std::ostream & operator<< (std::ostream& os, sampler<Space> & s);
 
-#ifdef SMCTC_HAVE_BGL
+#ifdef SMCTC_GENEALOGY
+    ///Returns the genealogy of the particle system.
+    const genealogy & GetGenealogy(void) const { return Genealogy; }
+    ///Obtain the index of the ancestor of particle n at each evolution time from 0 to the present.
+    void GetParticleLineage(long n, std::vector<long> & lIndices) const;
+    ///Returns the number of generations since the most recent common ancestor of the particles, or -1 if there is none.
+    long GetTimeToMRCA(void) const;
     /// Dump the particle graph to an output stream
     std::ostream & StreamParticleGraph(std::ostream & os) const;
 #endif
@@ -197,24 +292,70 @@ public:
 	/// \param nThreads Number of threads
 #if defined(_OPENMP)
 	void SetNumberOfThreads(const size_t n)
-	{ this->nThreads = n; };
+	{ this->nThreads = n; AllocateStreams(n); };
 #endif
 
 private:
     ///Duplication of smc::sampler is not currently permitted.
-    sampler(const sampler<Space> & sFrom);
+    sampler(const sampler<Space, Rng, Moveset> & sFrom);
     ///Duplication of smc::sampler is not currently permitted.
-    sampler<Space> & operator=(const sampler<Space> & sFrom);
-
-#ifdef SMCTC_HAVE_BGL
-    /// Add a level to the particle history graph
-    ///
-    /// \param parents: length N array with the parent index of each new particle. Alternatively, \c nullptr may be
-    /// passed to indicate that no resampling was performed.
-    ///
-    /// Should be called before incrementing T
-    void UpdateParticleGraph(const unsigned int* parents);
-#endif
+    sampler<Space, Rng, Moveset> & operator=(const sampler<Space, Rng, Moveset> & sFrom);
+
+    ///The stages of an iteration which draw from the per-particle random number streams.
+    enum StreamPhase { STREAM_MOVE = 0,
+                       STREAM_MCMC,
+                       STREAM_RESAMPLE,
+                       STREAM_MOVE_BLOCK,
+                       STREAM_MCMC_BLOCK,
+                       STREAM_SELECT,
+                       STREAM_PHASES = 16
+                     };
+
+    ///Allocate one random number stream generator and one scratch arena for each of n threads.
+    void AllocateStreams(size_t n);
+    ///Return the scratch arena of the calling thread within one of the parallel regions of the sampler.
+    arena & GetArena(void) const;
+    ///Return the calling thread's generator positioned at the stream of particle lIndex in the specified phase.
+    Rng* GetStream(StreamPhase nPhase, long lIndex) const { return GetStream(nPhase, T + 1, lIndex); }
+    ///Return the calling thread's generator positioned at the stream of element lIndex in the specified phase and epoch.
+    Rng* GetStream(StreamPhase nPhase, unsigned long lEpoch, long lIndex) const;
+
+    ///Replace the K values in pValues with their inclusive prefix sums.
+    template <class Value> void InclusiveScan(long K, Value* pValues) const;
+    ///Count the offspring of each of K particles under stratified or systematic resampling of M particles.
+    void SystematicCounts(long M, long K, double* dCumulative, const double* dUniforms, bool bStratified, unsigned int* uCount) const;
+    ///Map offspring counts to parent indices such that every particle which survives keeps its own position.
+    void CountsToIndices(long K, const unsigned int* uCount, unsigned int* uIndices, unsigned int* uFree) const;
+    ///Map offspring counts to a list of parent indices in increasing order.
+    void CountsToSortedIndices(long K, const unsigned int* uCount, unsigned int* uIndices) const;
+    ///Append the current particle set to the history in the manner appropriate to the history mode.
+    void PushHistory(void);
+    ///Record that each particle is its own ancestor, at the start of an iteration.
+    void ResetAncestors(void);
+    ///Returns the contribution of the current particle set at the specified time to a path sampling integral.
+    double PathSamplingTerm(const pathsampling & psIntegral, long lTime);
+    ///Add the contribution of the current particle set to each registered path sampling integral.
+    void AccumulatePathSampling(void);
+    ///Move every particle of the supplied population, in blocks if the moveset allows.
+    void MovePopulation(population<Space> & pPopulation, long lOffset);
+    ///Returns true if the particles are to be grouped by their selected moves before they are moved.
+    bool GroupingMoves(void) const { return bGroupMoves && !pMoves->HasMoveBlock() && pMoves->GetNumberOfMoves() > 1; }
+    ///Select a move for every particle of the supplied population, then apply each move to the particles which selected it.
+    void MoveGrouped(population<Space> & pPopulation, long lOffset);
+    ///Apply the MCMC moves to every particle, in blocks if the moveset allows; returns the number which moved.
+    long MCMCParticles(void);
+    ///Move the particle set, scale the weights so that the largest is one and return the effective sample size.
+    double MoveParticlesEss(void);
+    ///Returns the normalised weights of the particles, computing them if the log weights have changed since the last call.
+    const double* GetNormalisedWeights(void) const;
+    ///Record that the log weights have changed, so that the normalised weights must be recomputed.
+    void InvalidateWeights(void) { bWeightsCurrent = false; }
+    ///Set every log weight to zero and the normalised weights to 1/N without recomputing them.
+    void SetUniformWeights(void);
+    ///Returns the logarithm of the mean unnormalised weight of the particles.
+    double GetLogMeanWeight(void) const { GetNormalisedWeights(); return dLogWeightSum - log((double)pParticles.size()); }
+    ///Draw M ancestor indices, in increasing order, from the multinomial distribution with K category weights dWeights.
+    void MultinomialIndices(long M, long K, const double* dWeights, unsigned int* uIndices, double* dSpacings, double* dCumulative) const;
 };
 
 
@@ -225,11 +366,14 @@ private:
 /// \param lSize The number of particles present in the ensemble (at time 0 if this is a variable quantity)
 /// \param htHM The history mode to use: set this to SMC_HISTORY_RAM to store the whole history of the system and SMC_HISTORY_NONE to avoid doing so.
 /// \tparam Space The class used to represent a point in the sample space.
-template <class Space>
-sampler<Space>::sampler(long lSize, HistoryType htHM) :
-    pRng(new rng()),
+template <class Space, class Rng, class Moveset>
+sampler<Space, Rng, Moveset>::sampler(long lSize, HistoryType htHM) :
+    pRng(new Rng()),
     N(lSize)
 {
+    lStreamSeed = (unsigned long)(pRng->UniformS() * 4294967296.0);
+    AllocateStreams(1);
+
     pParticles.resize(lSize);
 
     //Allocate some storage for internal workspaces
@@ -238,9 +382,23 @@ sampler<Space>::sampler(long lSize, HistoryType htHM) :
     uRSCount.resize(N);
     ///Structure used internally for resampling.
     uRSIndices.resize(N);
+    uAncestors.resize(N);
+    ///Structure used internally for resampling.
+    dRSUniforms.resize(N);
+    ///Structure used internally for resampling.
+    dRSSpacings.resize(N + 1);
+    ///Structure used internally for resampling.
+    dRSCumulative.resize(N);
+    ///Structure used internally for resampling.
+    uRSFree.resize(N);
 
     //Some workable defaults.
     htHistoryMode = htHM;
+    bWeightsCurrent = false;
+    dLogNormaliser = 0;
+    bGroupMoves = false;
+    bDoubleBuffer = false;
+    lMaxParticles = 100000;
     rtResampleMode = SMC_RESAMPLE_STRATIFIED;
     dResampleThreshold = 0.5 * N;
 #if defined(_OPENMP)
@@ -254,14 +412,17 @@ sampler<Space>::sampler(long lSize, HistoryType htHM) :
 ///
 /// \param lSize The number of particles present in the ensemble (at time 0 if this is a variable quantity)
 /// \param htHM The history mode to use: set this to SMC_HISTORY_RAM to store the whole history of the system and SMC_HISTORY_NONE to avoid doing so.
-/// \param rngType The type of random number generator to use
+/// \param rngType The type of random number generator to use (this constructor is only available when Rng is smc::rng)
 /// \param rngSeed The seed to use for the random number generator
 /// \tparam Space The class used to represent a point in the sample space.
-template <class Space>
-sampler<Space>::sampler(long lSize, HistoryType htHM, const gsl_rng_type* rngType, unsigned long rngSeed) :
-    pRng(new rng(rngType, rngSeed)),
+template <class Space, class Rng, class Moveset>
+sampler<Space, Rng, Moveset>::sampler(long lSize, HistoryType htHM, const gsl_rng_type* rngType, unsigned long rngSeed) :
+    pRng(new Rng(rngType, rngSeed)),
     N(lSize)
 {
+    lStreamSeed = (unsigned long)(pRng->UniformS() * 4294967296.0);
+    AllocateStreams(1);
+
     pParticles.resize(lSize);
 
     //Allocate some storage for internal workspaces
@@ -270,9 +431,23 @@ sampler<Space>::sampler(long lSize, HistoryType htHM, const gsl_rng_type* rngTyp
     uRSCount.resize(N);
     ///Structure used internally for resampling.
     uRSIndices.resize(N);
+    uAncestors.resize(N);
+    ///Structure used internally for resampling.
+    dRSUniforms.resize(N);
+    ///Structure used internally for resampling.
+    dRSSpacings.resize(N + 1);
+    ///Structure used internally for resampling.
+    dRSCumulative.resize(N);
+    ///Structure used internally for resampling.
+    uRSFree.resize(N);
 
     //Some workable defaults.
     htHistoryMode  = htHM;
+    bWeightsCurrent = false;
+    dLogNormaliser = 0;
+    bGroupMoves = false;
+    bDoubleBuffer = false;
+    lMaxParticles = 100000;
     rtResampleMode = SMC_RESAMPLE_STRATIFIED;
     dResampleThreshold = 0.5 * N;
 #if defined(_OPENMP)
@@ -281,42 +456,102 @@ sampler<Space>::sampler(long lSize, HistoryType htHM, const gsl_rng_type* rngTyp
 }
 
 
-template <class Space>
-sampler<Space>::~sampler()
+/// The constructor prepares a sampler for use but does not assign any moves to the moveset, initialise the particles
+/// or otherwise perform any sampling related tasks. Its main function is to allocate a region of memory in which to
+/// store the particle set; the sampler takes ownership of the supplied random number generator.
+///
+/// \param lSize The number of particles present in the ensemble (at time 0 if this is a variable quantity)
+/// \param htHM The history mode to use: set this to SMC_HISTORY_RAM to store the whole history of the system and SMC_HISTORY_NONE to avoid doing so.
+/// \param pNewRng A random number generator allocated with new, e.g. new smc::fastrng(nSeed)
+/// \tparam Space The class used to represent a point in the sample space.
+template <class Space, class Rng, class Moveset>
+sampler<Space, Rng, Moveset>::sampler(long lSize, HistoryType htHM, Rng* pNewRng) :
+    pRng(pNewRng),
+    N(lSize)
 {
-}
+    lStreamSeed = (unsigned long)(pRng->UniformS() * 4294967296.0);
+    AllocateStreams(1);
 
-template <class Space>
-double sampler<Space>::GetESS(void) const
-{
-    long double sum = 0;
-    long double sumsq = 0;
+    pParticles.resize(lSize);
+
+    //Allocate some storage for internal workspaces
+    dRSWeights.resize(N);
+    ///Structure used internally for resampling.
+    uRSCount.resize(N);
+    ///Structure used internally for resampling.
+    uRSIndices.resize(N);
+    uAncestors.resize(N);
+    ///Structure used internally for resampling.
+    dRSUniforms.resize(N);
+    ///Structure used internally for resampling.
+    dRSSpacings.resize(N + 1);
+    ///Structure used internally for resampling.
+    dRSCumulative.resize(N);
+    ///Structure used internally for resampling.
+    uRSFree.resize(N);
 
-    for(int i = 0; i < pParticles.size(); i++)
-        sum += expl(pParticles[i].GetLogWeight());
+    //Some workable defaults.
+    htHistoryMode  = htHM;
+    bWeightsCurrent = false;
+    dLogNormaliser = 0;
+    bGroupMoves = false;
+    bDoubleBuffer = false;
+    lMaxParticles = 100000;
+    rtResampleMode = SMC_RESAMPLE_STRATIFIED;
+    dResampleThreshold = 0.5 * N;
+#if defined(_OPENMP)
+	nThreads = 1;
+#endif
+}
 
-    for(int i = 0; i < pParticles.size(); i++)
-        sumsq += expl(2.0 * (pParticles[i].GetLogWeight()));
+template <class Space, class Rng, class Moveset>
+sampler<Space, Rng, Moveset>::~sampler()
+{
+}
 
-    return expl(-log(sumsq) + 2 * log(sum));
+template <class Space, class Rng, class Moveset>
+double sampler<Space, Rng, Moveset>::GetESS(void) const
+{
+    return NormalisedESS(GetNormalisedWeights(), pParticles.size());
 }
 
 /// At present this function resets the system evolution time to 0 and calls the moveset initialisor to assign each
 /// particle in the ensemble.
 ///
 /// Note that the initialisation function must be specified before calling this function.
-template <class Space>
-void sampler<Space>::Initialise(void)
+template <class Space, class Rng, class Moveset>
+void sampler<Space, Rng, Moveset>::Initialise(void)
 {
     T = 0;
 
-    for(int i = 0; i < N; i++)
-        pParticles[i] = Moves.DoInit(pRng.get());
+    if(!pMoves)
+        throw SMC_EXCEPTION(SMCX_MISSING_MOVESET, "The sampler cannot be initialised until its moveset has been set.");
+
+    for(int i = 0; i < N; i++) {
+        arena::scope Scratch(*pArenas[0]);
+        pParticles.Set(i, pMoves->DoInit(pRng.get()));
+    }
+    InvalidateWeights();
+
+    for(size_t k = 0; k < PathSamplers.size(); ++k)
+        PathSamplers[k].dTerms.clear();
+    dLogNormaliser = 0;
+    dLogNormalisers.clear();
+
+    ResetAncestors();
+#ifdef SMCTC_GENEALOGY
+    Genealogy.Clear();
+    Genealogy.Extend(N, 0);
+#endif
 
     if(htHistoryMode != SMC_HISTORY_NONE) {
         while(History.Pop());
+        Ancestry.Clear();
+        if(htHistoryMode == SMC_HISTORY_DISK)
+            DiskHistory.Clear();
         nResampled = 0;
-        History.Push(N, pParticles.data(), 0, historyflags(nResampled));
+        nAccepted = 0;
+        PushHistory();
     }
 
     return;
@@ -329,18 +564,57 @@ void sampler<Space>::Initialise(void)
 /// \param pIntegrand The function to integrate with respect to the particle set
 /// \param pAuxiliary A pointer to any auxiliary data which should be passed to the function
 
-template <class Space>
-double sampler<Space>::Integrate(double(*pIntegrand)(const Space&, void*), void * pAuxiliary)
+template <class Space, class Rng, class Moveset>
+double sampler<Space, Rng, Moveset>::Integrate(double(*pIntegrand)(const Space&, void*), void * pAuxiliary)
 {
-    long double rValue = 0;
-    long double wSum = 0;
-    for(int i = 0; i < N; i++) {
-        rValue += expl(pParticles[i].GetLogWeight()) * pIntegrand(pParticles[i].GetValue(), pAuxiliary);
-        wSum  += expl(pParticles[i].GetLogWeight());
+    const double* dWeights = GetNormalisedWeights();
+    compensated_sum rValue;
+    for(int i = 0; i < N; i++)
+        rValue.Add(dWeights[i] * pIntegrand(pParticles.GetValue(i), pAuxiliary));
+
+    return rValue.GetSum();
+}
+
+/// The K statistics are evaluated together by fStatistics, which may be any callable object, such as a lambda, for
+/// which fStatistics(const Space & value, double* dValues) stores the statistics of value in dValues[0..K-1]. Their
+/// weighted means and variances under the empirical measure of the current particle set are accumulated in one
+/// parallel pass over blocks of SMC_BLOCK_SIZE particles, which are combined in block order so that the result does
+/// not depend upon the number of threads.
+///
+/// \param K The number of statistics
+/// \param fStatistics The function which computes the statistics of a particle value
+/// \param dMeans An array of K elements in which the weighted means are returned
+/// \param dVariances An array of K elements in which the weighted variances are returned, or null if they are not required
+template <class Space, class Rng, class Moveset>
+template <class Statistics>
+void sampler<Space, Rng, Moveset>::IntegrateMoments(long K, Statistics fStatistics, double* dMeans, double* dVariances)
+{
+    const double* dWeights = GetNormalisedWeights();
+    const long lBlocks = (N + SMC_BLOCK_SIZE - 1) / SMC_BLOCK_SIZE;
+    std::vector<moments> mBlocks(lBlocks, moments(K));
+
+    #pragma omp parallel num_threads(nThreads)
+    {
+        std::vector<double> dValues(K);
+        #pragma omp for
+        for(long b = 0; b < lBlocks; ++b) {
+            long lEnd = std::min<long>((b + 1) * SMC_BLOCK_SIZE, N);
+            for(long i = b * SMC_BLOCK_SIZE; i < lEnd; ++i) {
+                fStatistics(pParticles.GetValue(i), dValues.data());
+                mBlocks[b].Add(dWeights[i], dValues.data());
+            }
+        }
     }
 
-    rValue /= wSum;
-    return (double)rValue;
+    moments mTotal(K);
+    for(long b = 0; b < lBlocks; ++b)
+        mTotal.Merge(mBlocks[b]);
+
+    for(long k = 0; k < K; ++k) {
+        dMeans[k] = mTotal.GetMean(k);
+        if(dVariances)
+            dVariances[k] = mTotal.GetVariance(k);
+    }
 }
 
 /// This function is intended to be used to estimate integrals of the sort which must be evaluated to determine the
@@ -354,122 +628,164 @@ double sampler<Space>::Integrate(double(*pIntegrand)(const Space&, void*), void
 /// \param pIntegrand  The quantity which we wish to integrate at each time
 /// \param pWidth      A pointer to a function which specifies the width of each
 
-template <class Space>
-double sampler<Space>::IntegratePathSampling(double(*pIntegrand)(long, const particle<Space> &, void*), double(*pWidth)(long, void*), void* pAuxiliary)
+template <class Space, class Rng, class Moveset>
+double sampler<Space, Rng, Moveset>::IntegratePathSampling(double(*pIntegrand)(long, const particle<Space> &, void*), double(*pWidth)(long, void*), void* pAuxiliary)
 {
-    if(htHistoryMode == SMC_HISTORY_NONE)
+    if(htHistoryMode != SMC_HISTORY_RAM && htHistoryMode != SMC_HISTORY_DISK)
         throw SMC_EXCEPTION(SMCX_MISSING_HISTORY, "The path sampling integral cannot be computed as the history of the system was not stored.");
 
-    History.Push(N, pParticles.data(), nAccepted, historyflags(nResampled));
-    double dRes = History.IntegratePathSampling(pIntegrand, pWidth, pAuxiliary);
-    History.Pop();
+    double dRes;
+    if(htHistoryMode == SMC_HISTORY_DISK) {
+        DiskHistory.Push(pParticles, nAccepted, historyflags(nResampled));
+        dRes = DiskHistory.IntegratePathSampling(pIntegrand, pWidth, pAuxiliary);
+        DiskHistory.Pop(NULL, NULL);
+    } else {
+        History.Push(N, pParticles.GetParticles(), nAccepted, historyflags(nResampled));
+        dRes = History.IntegratePathSampling(pIntegrand, pWidth, pAuxiliary);
+        History.Pop();
+    }
     return dRes;
 }
 
+/// The integral is estimated in the same way as by IntegratePathSampling, but each term is computed from the particle
+/// set at the start of every iteration and only the terms are retained, so no history of the system need be stored.
+/// Integrals must be registered before the sampler is initialised; Initialise discards the terms accumulated so far.
+///
+/// \param pIntegrand  The quantity which we wish to integrate at each time
+/// \param pWidth      A pointer to a function which specifies the width of each step of the path sampling grid
+/// \param pAuxiliary  A pointer to auxiliary data to pass to both of the above functions
+template <class Space, class Rng, class Moveset>
+long sampler<Space, Rng, Moveset>::AddPathSampling(double(*pIntegrand)(long, const particle<Space> &, void*), double(*pWidth)(long, void*), void* pAuxiliary)
+{
+    pathsampling psIntegral;
+    psIntegral.pIntegrand = pIntegrand;
+    psIntegral.pWidth = pWidth;
+    psIntegral.pAuxiliary = pAuxiliary;
+    PathSamplers.push_back(psIntegral);
+    return PathSamplers.size() - 1;
+}
+
+/// The value returned is that which IntegratePathSampling would return for the same integrand and width functions.
+///
+/// \param lIndex The index returned by AddPathSampling when the integral was registered
+template <class Space, class Rng, class Moveset>
+double sampler<Space, Rng, Moveset>::GetPathSampling(long lIndex)
+{
+    if(lIndex < 0 || lIndex >= (long)PathSamplers.size())
+        throw SMC_EXCEPTION(SMCX_MISSING_HISTORY, "The requested path sampling integral has not been registered.");
+
+    const pathsampling & psIntegral = PathSamplers[lIndex];
+    compensated_sum rValue;
+    for(size_t t = 0; t < psIntegral.dTerms.size(); ++t)
+        rValue.Add(psIntegral.dTerms[t]);
+    rValue.Add(PathSamplingTerm(psIntegral, T + 1));
+    return rValue.GetSum();
+}
+
 /// The iterate function:
 ///         -# appends the current particle set to the history if desired
 ///          -# moves the current particle set
 ///         -# checks the effective sample size and resamples if necessary
 ///         -# performs a mcmc step if required
 ///         -# increments the current evolution time
-template <class Space>
-void sampler<Space>::Iterate(void)
+template <class Space, class Rng, class Moveset>
+void sampler<Space, Rng, Moveset>::Iterate(void)
 {
     IterateEss();
     return;
 }
 
-template <class Space>
-void sampler<Space>::IterateBack(void)
+template <class Space, class Rng, class Moveset>
+void sampler<Space, Rng, Moveset>::IterateBack(void)
 {
-    if(htHistoryMode == SMC_HISTORY_NONE)
+    if(htHistoryMode != SMC_HISTORY_RAM && htHistoryMode != SMC_HISTORY_DISK)
         throw SMC_EXCEPTION(SMCX_MISSING_HISTORY, "An attempt to undo an iteration was made; unforunately, the system history has not been stored.");
+    if(T == 0 || dLogNormalisers.empty())
+        throw SMC_EXCEPTION(SMCX_MISSING_HISTORY, "An attempt to undo an iteration was made, but no iteration has been stored since the sampler was initialised.");
+    //The history holds the particle set present at the start of every iteration, so it is one deeper than the time.
+    const long lDepth = htHistoryMode == SMC_HISTORY_DISK ? DiskHistory.GetLength() : History.GetLength();
+    if(lDepth < T + 1)
+        throw SMC_EXCEPTION(SMCX_MISSING_HISTORY, "An attempt to undo an iteration was made, but the history does not hold every iteration since the sampler was initialised.");
+    for(size_t k = 0; k < PathSamplers.size(); ++k)
+        if(PathSamplers[k].dTerms.empty())
+            throw SMC_EXCEPTION(SMCX_MISSING_HISTORY, "An attempt to undo an iteration was made, but a path sampling integral holds no term for it.");
+
+    for(size_t k = 0; k < PathSamplers.size(); ++k)
+        PathSamplers[k].dTerms.pop_back();
+    dLogNormaliser = dLogNormalisers.back();
+    dLogNormalisers.pop_back();
+#ifdef SMCTC_GENEALOGY
+    //Lineages which are pruned cannot be restored, so the genealogy starts afresh from the restored generation.
+    Genealogy.Clear();
+    Genealogy.Extend(pParticles.size(), 0);
+#endif
 
-    History.Pop(&N, &pParticles, &nAccepted, NULL);
+    if(htHistoryMode == SMC_HISTORY_DISK) {
+        DiskHistory.Pop(&pParticles, &nAccepted);
+        N = pParticles.size();
+        InvalidateWeights();
+        T--;
+        return;
+    }
+
+    //The number of particles does not change between generations, so the popped generation fits in place.
+    particle<Space>* pRestored = pParticles.GetParticles();
+    History.Pop(&N, &pRestored, &nAccepted, NULL);
+    pParticles.UpdateLogWeights();
+    InvalidateWeights();
     T--;
     return;
 }
 
-template <class Space>
-const std::vector<unsigned int> sampler<Space>::SampleMultinomial(long M) const
+template <class Space, class Rng, class Moveset>
+const std::vector<unsigned int> sampler<Space, Rng, Moveset>::SampleMultinomial(long M) const
 {
     // Collect the weights of the particles.
-    std::vector<double> dWeights(pParticles.size());
-    for (size_t i = 0; i < pParticles.size(); ++i) {
-        dWeights[i] = pParticles[i].GetWeight();
-    }
+    const double* dWeights = GetNormalisedWeights();
 
-    // Generate a vector of sample counts.
-    std::vector<unsigned int> uCount(pParticles.size());
-    pRng->Multinomial(M, pParticles.size(), dWeights.data(), uCount.data());
-
-    // Transform the vector of sample counts into a vector of parent indices.
+    // Draw the parent indices directly; they are produced in increasing order.
     std::vector<unsigned int> uIndices(M);
-    for (size_t i = 0, j = 0; i < uCount.size(); ++i) {
-        while (uCount[i] > 0) {
-            uIndices[j++] = i;
-            --uCount[i];
-        }
-    }
+    std::vector<double> dSpacings(M + 1), dCumulative(pParticles.size());
+    MultinomialIndices(M, pParticles.size(), dWeights, uIndices.data(), dSpacings.data(), dCumulative.data());
 
     return uIndices;
 }
 
-template <class Space>
-const std::vector<unsigned int> sampler<Space>::SampleSystematic(long M, bool bStratified) const
+template <class Space, class Rng, class Moveset>
+const std::vector<unsigned int> sampler<Space, Rng, Moveset>::SampleSystematic(long M, bool bStratified) const
 {
     // Procedure for stratified sampling
     // See Appendix of Kitagawa 1996, http://www.jstor.org/stable/1390750,
     // or p.290 of the Doucet et al book, an image of which is at:
     // http://cl.ly/image/200T0y473k1d/stratified_resampling.jpg
+    const long K = pParticles.size();
 
-    // Calculate the normalising constant of the weight vector
-    double dWeightSum = 0.0;
-    for (size_t i = 0; i < pParticles.size(); ++i)
-        dWeightSum += exp(pParticles[i].GetLogWeight());
-
-    // dWeightCumulative is \tilde{\pi}^r from the Doucet book.
-    double dWeightCumulative = 0.0;
-    //Generate a uniform random number between 0 and 1/M.
-    double dRand = pRng->Uniform(0, 1.0 / M);
-
-    std::vector<unsigned int> uCount(pParticles.size(), 0);
-
-    for (size_t i = 0, j = 0; i < pParticles.size() && j < M; ++i) {
-        dWeightCumulative += exp(pParticles[i].GetLogWeight()) / dWeightSum;
-        while (dWeightCumulative > ((static_cast<double>(j) / M) + dRand) && j < M) {
-            ++uCount[i];
-            ++j;
-
-            // The only difference between stratified and systematic resampling
-            // is whether a new random variable is drawn for each partition of
-            // the (0, 1] interval.
-            if (bStratified) {
-                dRand = pRng->Uniform(0, 1.0 / M);
-            }
-        }
-    }
+    // Collect the weights; SystematicCounts replaces them with the normalised cumulative weights.
+    const double* dWeights = GetNormalisedWeights();
+    std::vector<double> dCumulative(dWeights, dWeights + K);
+
+    // Generate the uniform random numbers between 0 and 1/M: one for each stratum, or a single common one.
+    std::vector<double> dUniforms(bStratified ? M : 1);
+    pRng->UniformBatch(dUniforms.data(), dUniforms.size(), 0, 1.0 / M);
+
+    std::vector<unsigned int> uCount(K);
+    SystematicCounts(M, K, dCumulative.data(), dUniforms.data(), bStratified, uCount.data());
 
     // Transform the vector of sample counts into a vector of parent indices.
     std::vector<unsigned int> uIndices(M);
-    for (size_t i = 0, j = 0; i < uCount.size(); ++i) {
-        while (uCount[i] > 0) {
-            uIndices[j++] = i;
-            --uCount[i];
-        }
-    }
+    CountsToSortedIndices(K, uCount.data(), uIndices.data());
 
     return uIndices;
 }
 
-template <class Space>
-const std::vector<unsigned int> sampler<Space>::SampleStratified(long M) const
+template <class Space, class Rng, class Moveset>
+const std::vector<unsigned int> sampler<Space, Rng, Moveset>::SampleStratified(long M) const
 {
     return SampleSystematic(M, true);
 }
 
-template <class Space>
-void sampler<Space>::ResampleFribble(double dESS)
+template <class Space, class Rng, class Moveset>
+void sampler<Space, Rng, Moveset>::ResampleFribble(double dESS)
 {
     assert(pParticles.size() == N);
 
@@ -479,6 +795,9 @@ void sampler<Space>::ResampleFribble(double dESS)
 
     std::clog << "[ResampleFribble] starting ESS = " << dESS << '\n';
 
+    // The ancestor, in the most recently stored generation, of each member of the growing population.
+    std::vector<unsigned int> uOrigins(uAncestors);
+
     while (dESS < dResampleThreshold) {
         //long M = static_cast<long>(std::ceil(dResampleThreshold - dESS));
         long M = N;
@@ -489,10 +808,14 @@ void sampler<Space>::ResampleFribble(double dESS)
         // Generate M new particles by perturbation of the selected parents.
         pParticles.reserve(pParticles.size() + M);
         for (size_t i = 0; i < uIndices.size(); ++i) {
-            const auto& parent = pParticles[uIndices[i]];
-            pParticles.emplace_back(parent.GetValue(), parent.GetLogWeight());
-            Moves.DoMCMC(T + 1, pParticles.back(), pRng.get());
+            arena::scope Scratch(*pArenas[0]);
+            pParticles.Append(pParticles.GetParticle(uIndices[i]));
+            uOrigins.push_back(uOrigins[uIndices[i]]);
+            const long n = pParticles.size() - 1;
+            pMoves->DoMCMC(T + 1, pParticles.Checkout(n), pRng.get());
+            pParticles.Checkin(n);
         }
+        InvalidateWeights();
 
         dESS = GetESS();
 
@@ -511,163 +834,197 @@ void sampler<Space>::ResampleFribble(double dESS)
     pNewParticles.reserve(N);
 
     // Replicate the chosen particles.
+    //The indices are in increasing order and the old population is discarded, so the last copy of each particle
+    //takes its value.
     for (size_t i = 0; i < uIndices.size() ; ++i) {
-        const auto& parent = pParticles[uIndices[i]];
-        pNewParticles.emplace_back(parent.GetValue(), 0.0);
+        if (i + 1 < uIndices.size() && uIndices[i + 1] == uIndices[i])
+            pNewParticles.Append(pParticles.GetParticle(uIndices[i]));
+        else
+            pNewParticles.Append(pParticles.Release(uIndices[i]));
+        uAncestors[i] = uOrigins[uIndices[i]];
     }
 
-    pParticles = pNewParticles;
+    pParticles = std::move(pNewParticles);
+    SetUniformWeights();
     assert(pParticles.size() == N);
 }
 
-template <class Space>
-double sampler<Space>::IterateEssVariable(DatabaseHistory* database_history)
+template <class Space, class Rng, class Moveset>
+double sampler<Space, Rng, Moveset>::IterateEssVariable(DatabaseHistory* database_history)
 {
     assert(pParticles.size() == N);
 
     // Append the current population to the history, if requested.
-    if (htHistoryMode != SMC_HISTORY_NONE)
-        History.Push(N, pParticles.data(), nAccepted, historyflags(nResampled));
+    if (htHistoryMode != SMC_HISTORY_NONE) {
+        PushHistory();
+        dLogNormalisers.push_back(dLogNormaliser);
+    }
+    ResetAncestors();
+    AccumulatePathSampling();
 
-    // Stash copies of the original particles; we'll need them to generate new ones.
-    const auto pStartingParticles = pParticles;
+    // Stash the original particles; each round generates new ones from them.
+    const auto pStartingParticles = std::move(pParticles);
     pParticles.clear();
+    decltype(pParticles) pNewParticles;
 
+    // The sums of the weights of the growing population are kept up to date as each round is added, so the ESS of
+    // the population costs only the new particles to compute.
+    weightsum wGrowth;
     double dESS = 0.0;
-    double dGlobalMaxWeight = -std::numeric_limits<double>::infinity();
+    long M = std::min(N, lMaxParticles);
+
+    // The starting particle from which each member of the growing population is generated, and the order in which
+    // the starting particles are used within the current cycle of N members.
+    std::vector<long> lOrigins;
+    std::vector<long> lOrder(N);
 
     if (database_history)
         database_history->clear();
 
     do {
-        // Generate new particles from the originals via SMC moves.
-        auto pNewParticles = pStartingParticles;
-		#pragma omp parallel for num_threads(nThreads)
-		for(int i = 0; i < N; i++) {
-            Moves.DoMove(T + 1, pNewParticles[i], pRng.get());
+        // Generate M new particles. Each cycle of N members of the growing population uses every starting particle
+        // once. The copies keep the weights of the starting particles, so the population may stop part way through a
+        // cycle only if every starting particle is equally likely to have been used in it: a cycle is taken in order
+        // only if this round completes it, and otherwise in a random order.
+        const long lOffset = pParticles.size();
+        lOrigins.resize(lOffset + M);
+        for (long n = lOffset; n < lOffset + M; ++n) {
+            if (n % N == 0) {
+                for (long j = 0; j < N; ++j)
+                    lOrder[j] = j;
+                if (n + N > lOffset + M) {
+                    for (long j = N - 1; j > 0; --j)
+                        std::swap(lOrder[j], lOrder[pRng->UniformDiscrete(0, j)]);
+                }
+            }
+            lOrigins[n] = lOrder[n % N];
         }
-
-        // Normalize the weights.
-        double dLocalMaxWeight = -std::numeric_limits<double>::infinity();
-        for (const auto& p : pNewParticles)
-            dLocalMaxWeight = std::max(dLocalMaxWeight, p.GetLogWeight());
-
-        //
-        // TODO: Clean up this spaghetti.
-        //
-
-        if (pParticles.empty())
-            dGlobalMaxWeight = dLocalMaxWeight;
-
-        if (dLocalMaxWeight > dGlobalMaxWeight) {
-            for (auto& p : pParticles)
-                p.AddToLogWeight(dGlobalMaxWeight - dLocalMaxWeight);
-            for (auto& p : pNewParticles)
-                p.AddToLogWeight(-dLocalMaxWeight);
-
-            dGlobalMaxWeight = dLocalMaxWeight;
-        } else {
-            for (auto& p : pNewParticles)
-                p.AddToLogWeight(-dGlobalMaxWeight);
+        pNewParticles.resize(M);
+	#pragma omp parallel for num_threads(nThreads)
+        for (long i = 0; i < M; ++i) {
+            pNewParticles.CopyValue(i, pStartingParticles, lOrigins[lOffset + i]);
+            pNewParticles.SetLogWeight(i, pStartingParticles.GetLogWeight(lOrigins[lOffset + i]));
         }
+        MovePopulation(pNewParticles, lOffset);
 
         // Add the newly-generated particles to the population.
-        pParticles.insert(pParticles.end(), pNewParticles.begin(), pNewParticles.end());
+        wGrowth.Add(pNewParticles.GetLogWeights(), M);
+        pParticles.Append(std::move(pNewParticles));
 
-        dESS = GetESS();
-        std::clog << "[IterateEssVariable] ESS = " << dESS << ", N = " << pParticles.size() << '\n';
+        dESS = wGrowth.GetESS();
 
         if (database_history) {
             database_history->ess.push_back(dESS);
         }
-    } while (dESS < dResampleThreshold && pParticles.size() < 100000);
+
+        // Size the next round to make up the deficit, supposing that the ESS grows in proportion to the number of
+        // particles. The population is at most doubled at once, as the prediction is poor while the ESS is small, and
+        // each round has at least N/16 particles so that a slight shortfall does not take many small rounds. Another
+        // round is only made while the population is below the limit, so it always has at least one particle.
+        const long lSize = pParticles.size();
+        M = lSize;
+        if (dESS > 0 && dResampleThreshold / dESS < 2.0)
+            M = static_cast<long>(std::ceil(lSize * (dResampleThreshold / dESS - 1.0)));
+        M = std::min(std::max(M, std::max(1L, N / 16)), lMaxParticles - lSize);
+    } while (dESS < dResampleThreshold && pParticles.size() < lMaxParticles);
+    std::clog << "[IterateEssVariable] ESS = " << dESS << ", N = " << pParticles.size() << '\n';
+
+    // Express the weights relative to the largest, once, now that the population is complete.
+    const double dGlobalMaxWeight = wGrowth.GetMax();
+    if (dGlobalMaxWeight > -std::numeric_limits<double>::infinity()) {
+        double* dLogWeights = pParticles.GetLogWeights();
+        const long lSize = pParticles.size();
+	#pragma omp parallel for num_threads(nThreads)
+        for (long i = 0; i < lSize; ++i)
+            dLogWeights[i] -= dGlobalMaxWeight;
+    }
+    InvalidateWeights();
+
+    // Each batch of new particles gives an estimate of the increment of the normalising constant; the mean weight of
+    // the whole population, relative to the maximum which was subtracted from it, is their average.
+    dLogNormaliser += dGlobalMaxWeight;
 
     //
-    // Resample the population back down to N particles.
+    // Resample the population back to N particles; it has fewer only if the limit on its size is below N.
     //
 
-    if (pParticles.size() > N) {
+    if (pParticles.size() != N) {
         nResampled = 1;
 
-        std::clog << "[IterateEssVariable] downsampling from " << pParticles.size() << " to " << N << " particles\n";
+        std::clog << "[IterateEssVariable] resampling from " << pParticles.size() << " to " << N << " particles\n";
+        dLogNormaliser += GetLogMeanWeight();
 
         auto uIndices = SampleStratified(N);
         decltype(pParticles) pSampledParticles;
         pSampledParticles.reserve(N);
 
-        // Replicate the chosen particles.
+        // Replicate the chosen particles, each of which is descended from the starting particle it was generated from.
+        // As the indices are in increasing order, the last copy of each particle takes its value.
         for (size_t i = 0; i < uIndices.size() ; ++i) {
-            const auto& parent = pParticles[uIndices[i]];
-            pSampledParticles.emplace_back(parent.GetValue(), 0.0);
+            if (i + 1 < uIndices.size() && uIndices[i + 1] == uIndices[i])
+                pSampledParticles.Append(pParticles.GetParticle(uIndices[i]));
+            else
+                pSampledParticles.Append(pParticles.Release(uIndices[i]));
+            uAncestors[i] = lOrigins[uIndices[i]];
         }
 
-        pParticles = pSampledParticles;
+        pParticles = std::move(pSampledParticles);
+        SetUniformWeights();
     }
 
     //
     // (Optional) MCMC moves.
     //
 
-    double nAcceptedLocal = 0;
-	#pragma omp parallel for reduction(+:nAcceptedLocal) num_threads(nThreads)
-	for(int i = 0; i < N; i++) {
-		if(Moves.DoMCMC(T + 1, pParticles[i], pRng.get()))
-            ++nAcceptedLocal;
-    }
-	nAccepted = nAcceptedLocal;
+    nAccepted = MCMCParticles();
+
+#ifdef SMCTC_GENEALOGY
+    Genealogy.Extend(N, uAncestors.data());
+#endif
     ++T;
 
     assert(pParticles.size() == N);
     return dESS;
 }
 
-template <class Space>
-double sampler<Space>::IterateEss(void)
+template <class Space, class Rng, class Moveset>
+double sampler<Space, Rng, Moveset>::IterateEss(void)
 {
     //Initially, the current particle set should be appended to the historical process.
-    if(htHistoryMode != SMC_HISTORY_NONE)
-        History.Push(N, pParticles.data(), nAccepted, historyflags(nResampled));
+    if(htHistoryMode != SMC_HISTORY_NONE) {
+        PushHistory();
+        dLogNormalisers.push_back(dLogNormaliser);
+    }
+    ResetAncestors();
+    AccumulatePathSampling();
 
     nAccepted = 0;
 
-    //Move the particle set.
-    MoveParticles();
-
-    //Normalise the weights to sensible values....
-    double dMaxWeight = -std::numeric_limits<double>::infinity();
-    for(int i = 0; i < N; i++)
-        dMaxWeight = std::max(dMaxWeight, pParticles[i].GetLogWeight());
-    for(int i = 0; i < N; i++)
-        pParticles[i].SetLogWeight(pParticles[i].GetLogWeight() - (dMaxWeight));
-
+    //Move the particle set, normalise the weights to sensible values and obtain the ESS.
+    double ESS = MoveParticlesEss();
 
     //Check if the ESS is below some reasonable threshold and resample if necessary.
     //A mechanism for setting this threshold is required.
-    double ESS = GetESS();
     if(ESS < dResampleThreshold) {
         nResampled = 1;
+        //Resampling leaves every particle with the mean weight, which is retained by the normalising constant.
+        dLogNormaliser += GetLogMeanWeight();
         if (rtResampleMode == SMC_RESAMPLE_FRIBBLEBITS) {
             ResampleFribble(ESS);
         } else {
             Resample(rtResampleMode);
         }
     } else {
-#ifdef SMCTC_HAVE_BGL
-        UpdateParticleGraph(nullptr);
-#endif
         nResampled = 0;
     }
 
-    if (rtResampleMode != SMC_RESAMPLE_FRIBBLEBITS) {
-		double nAcceptedLocal = nAccepted;
-        //A possible MCMC step should be included here.
-		#pragma omp parallel for reduction(+:nAcceptedLocal) num_threads(nThreads)
-        for(int i = 0; i < N; i++) {
-            if(Moves.DoMCMC(T + 1, pParticles[i], pRng.get()))
-                nAcceptedLocal++;
-        }
-		nAccepted = nAcceptedLocal;
-    }
+    //A possible MCMC step should be included here.
+    if (rtResampleMode != SMC_RESAMPLE_FRIBBLEBITS)
+        nAccepted += MCMCParticles();
+
+#ifdef SMCTC_GENEALOGY
+    Genealogy.Extend(N, uAncestors.data());
+#endif
 
     // Increment the evolution time.
     T++;
@@ -675,154 +1032,356 @@ double sampler<Space>::IterateEss(void)
     return ESS;
 }
 
-template <class Space>
-void sampler<Space>::IterateUntil(long lTerminate)
+template <class Space, class Rng, class Moveset>
+void sampler<Space, Rng, Moveset>::IterateUntil(long lTerminate)
 {
     while(T < lTerminate)
         Iterate();
 }
 
-template <class Space>
-void sampler<Space>::MoveParticles(void)
+template <class Space, class Rng, class Moveset>
+void sampler<Space, Rng, Moveset>::MoveParticles(void)
 {
+    MovePopulation(pParticles, 0);
+    InvalidateWeights();
+}
+
+/// If the moveset has a function which moves a range of particles, each block of SMC_BLOCK_SIZE particles is passed
+/// to it in a single call, with a stream identified by the index of the block's first particle. Otherwise each
+/// particle is moved separately using its own stream.
+///
+/// \param pPopulation The particles to move
+/// \param lOffset The index, among all of the particles moved during this iteration, of the first particle of pPopulation
+template <class Space, class Rng, class Moveset>
+void sampler<Space, Rng, Moveset>::MovePopulation(population<Space> & pPopulation, long lOffset)
+{
+    const long lSize = pPopulation.size();
+    if(pMoves->HasMoveBlock()) {
+        const long lBlocks = (lSize + SMC_BLOCK_SIZE - 1) / SMC_BLOCK_SIZE;
+        #pragma omp parallel for num_threads(nThreads)
+        for(long b = 0; b < lBlocks; ++b) {
+            long lStart = b * SMC_BLOCK_SIZE;
+            long lEnd = std::min<long>(lStart + SMC_BLOCK_SIZE, lSize);
+            arena::scope Scratch(GetArena());
+            pMoves->DoMoveBlock(T + 1, pPopulation.CheckoutRange(lStart, lEnd), lEnd - lStart, GetStream(STREAM_MOVE_BLOCK, lOffset + lStart));
+            pPopulation.CheckinRange(lStart, lEnd);
+        }
+        return;
+    }
+
+    if(GroupingMoves()) {
+        MoveGrouped(pPopulation, lOffset);
+        return;
+    }
+
 	#pragma omp parallel for num_threads(nThreads)
-    for(int i = 0; i < N; i++) {
-        Moves.DoMove(T + 1, pParticles[i], pRng.get());
-        //  pParticles[i].Set(pNew.value, pNew.logweight);
+    for(long i = 0; i < lSize; i++) {
+        arena::scope Scratch(GetArena());
+        pMoves->DoMove(T + 1, pPopulation.Checkout(i), GetStream(STREAM_MOVE, lOffset + i));
+        pPopulation.Checkin(i);
     }
 }
 
+/// The move for each particle is chosen using a stream of its own, in parallel, and the indices of the particles are
+/// then sorted by the chosen move with a counting sort which preserves their order. The particles are finally moved
+/// in that order, so that consecutive particles usually share a move, each using the same stream as it would have if
+/// the moves had not been grouped. Since the selection draws from a separate stream, the results are not identical to
+/// those obtained without grouping but have the same distribution.
+///
+/// \param pPopulation The particles to move
+/// \param lOffset The index, among all of the particles moved during this iteration, of the first particle of pPopulation
+template <class Space, class Rng, class Moveset>
+void sampler<Space, Rng, Moveset>::MoveGrouped(population<Space> & pPopulation, long lOffset)
+{
+    const long lSize = pPopulation.size();
+    const long lMoves = pMoves->GetNumberOfMoves();
+    uMoveChoice.resize(lSize);
+    uMoveOrder.resize(lSize);
+
+	#pragma omp parallel for num_threads(nThreads)
+    for(long i = 0; i < lSize; i++) {
+        arena::scope Scratch(GetArena());
+        uMoveChoice[i] = pMoves->DoSelect(T + 1, pPopulation.Checkout(i), GetStream(STREAM_SELECT, lOffset + i));
+    }
+
+    std::vector<long> lStart(lMoves + 1, 0);
+    for(long i = 0; i < lSize; i++)
+        lStart[uMoveChoice[i] + 1]++;
+    for(long k = 0; k < lMoves; k++)
+        lStart[k + 1] += lStart[k];
+    for(long i = 0; i < lSize; i++)
+        uMoveOrder[lStart[uMoveChoice[i]]++] = i;
+
+	#pragma omp parallel for num_threads(nThreads)
+    for(long j = 0; j < lSize; j++) {
+        const long i = uMoveOrder[j];
+        arena::scope Scratch(GetArena());
+        pMoves->DoMoveNumber(uMoveChoice[i], T + 1, pPopulation.Checkout(i), GetStream(STREAM_MOVE, lOffset + i));
+        pPopulation.Checkin(i);
+    }
+}
+
+/// The MCMC moves are applied to each block of SMC_BLOCK_SIZE particles in a single call if the moveset has a
+/// function which accepts a range of particles, and to each particle separately otherwise.
+template <class Space, class Rng, class Moveset>
+long sampler<Space, Rng, Moveset>::MCMCParticles(void)
+{
+    long nMoved = 0;
+    bool bWeightsChanged = false;
+
+    if(pMoves->HasMCMCBlock()) {
+        const long lBlocks = (N + SMC_BLOCK_SIZE - 1) / SMC_BLOCK_SIZE;
+        #pragma omp parallel for reduction(+:nMoved) reduction(||:bWeightsChanged) num_threads(nThreads)
+        for(long b = 0; b < lBlocks; ++b) {
+            long lStart = b * SMC_BLOCK_SIZE;
+            long lEnd = std::min<long>(lStart + SMC_BLOCK_SIZE, N);
+            arena::scope Scratch(GetArena());
+            nMoved += pMoves->DoMCMCBlock(T + 1, pParticles.CheckoutRange(lStart, lEnd), lEnd - lStart, GetStream(STREAM_MCMC_BLOCK, lStart));
+            if(pParticles.CheckinRange(lStart, lEnd))
+                bWeightsChanged = true;
+        }
+    } else {
+		#pragma omp parallel for reduction(+:nMoved) reduction(||:bWeightsChanged) num_threads(nThreads)
+        for(long i = 0; i < N; i++) {
+            arena::scope Scratch(GetArena());
+            if(pMoves->DoMCMC(T + 1, pParticles.Checkout(i), GetStream(STREAM_MCMC, i)))
+                nMoved++;
+            if(pParticles.Checkin(i))
+                bWeightsChanged = true;
+        }
+    }
+
+    if(bWeightsChanged)
+        InvalidateWeights();
+    return nMoved;
+}
+
+/// In SMC_HISTORY_RAM mode every particle is copied into the history, and in SMC_HISTORY_DISK mode it is appended to
+/// the history file. In SMC_HISTORY_ANCESTRY mode the particles are stored along with the index of their ancestor in
+/// the previous stored generation, and any earlier particles which no longer have descendants are discarded.
+template <class Space, class Rng, class Moveset>
+void sampler<Space, Rng, Moveset>::PushHistory(void)
+{
+    if(htHistoryMode == SMC_HISTORY_ANCESTRY)
+        Ancestry.Push(N, pParticles.GetParticles(), uAncestors.data(), nAccepted, historyflags(nResampled));
+    else if(htHistoryMode == SMC_HISTORY_DISK)
+        DiskHistory.Push(pParticles, nAccepted, historyflags(nResampled));
+    else
+        History.Push(N, pParticles.GetParticles(), nAccepted, historyflags(nResampled));
+}
+
+/// Until the next resampling step each particle is descended from the one in the same position. The iterations
+/// which store the history do so first, so uAncestors then refers to the most recently stored generation.
+template <class Space, class Rng, class Moveset>
+void sampler<Space, Rng, Moveset>::ResetAncestors(void)
+{
+    for(long i = 0; i < N; ++i)
+        uAncestors[i] = i;
+}
+
+/// The stored history holds the particle set present at the start of iteration t at position t, so the term for
+/// that iteration is evaluated at time t; the current particle set is treated as the start of the next iteration.
+///
+/// \param psIntegral The path sampling integral
+/// \param lTime The evolution time which is passed to the integrand and width functions
+template <class Space, class Rng, class Moveset>
+double sampler<Space, Rng, Moveset>::PathSamplingTerm(const pathsampling & psIntegral, long lTime)
+{
+    const double* dWeights = GetNormalisedWeights();
+    const particle<Space>* pValues = pParticles.GetParticles();
+    compensated_sum rValue;
+    for(long i = 0; i < N; i++)
+        rValue.Add(dWeights[i] * psIntegral.pIntegrand(lTime, pValues[i], psIntegral.pAuxiliary));
+    return rValue.GetSum() * psIntegral.pWidth(lTime, psIntegral.pAuxiliary);
+}
+
+template <class Space, class Rng, class Moveset>
+void sampler<Space, Rng, Moveset>::AccumulatePathSampling(void)
+{
+    for(size_t k = 0; k < PathSamplers.size(); ++k)
+        PathSamplers[k].dTerms.push_back(PathSamplingTerm(PathSamplers[k], T + 1));
+}
+
+/// The path consists of the ancestor of particle n at each evolution time from 0 to the present, ending with the
+/// particle itself. Only the particles with descendants in the current generation are retained by the history, so
+/// this function requires SMC_HISTORY_ANCESTRY mode.
+///
+/// \param n The index of the particle whose path is required
+/// \param pPath The vector in which the path is returned
+template <class Space, class Rng, class Moveset>
+void sampler<Space, Rng, Moveset>::GetParticlePath(long n, std::vector<particle<Space> > & pPath) const
+{
+    if(htHistoryMode != SMC_HISTORY_ANCESTRY)
+        throw SMC_EXCEPTION(SMCX_MISSING_HISTORY, "Particle paths can only be reconstructed when the ancestry of the system is stored.");
+
+    //The initial particle set is stored by Initialise and again by the first iteration, which pushes each generation
+    //before moving it; the copy stored by Initialise is omitted and the current particle completes the path.
+    Ancestry.GetPath(uAncestors[n], pPath);
+    if(T > 0) {
+        pPath.erase(pPath.begin());
+        pPath.push_back(pParticles.GetParticle(n));
+    }
+}
+
+/// This is equivalent to MoveParticles followed by the normalisation of the log weights and GetESS, but needs only
+/// two passes over the particle set. The first pass moves each block of SMC_BLOCK_SIZE particles and, while their
+/// log weights are still in cache, accumulates the block's maximum log weight and weight sums relative to it. The
+/// block summaries are merged in block order, which makes the result independent of the number of threads, and the
+/// second pass subtracts the overall maximum from each log weight while filling in the normalised weights.
+template <class Space, class Rng, class Moveset>
+double sampler<Space, Rng, Moveset>::MoveParticlesEss(void)
+{
+    const long lBlocks = (N + SMC_BLOCK_SIZE - 1) / SMC_BLOCK_SIZE;
+    std::vector<weightsum> wBlocks(lBlocks);
+    double* dLogWeights = pParticles.GetLogWeights();
+
+    //Grouping the particles by move takes them out of order, so then the moves cannot be fused with the reduction.
+    const bool bGrouped = GroupingMoves();
+    if(bGrouped)
+        MoveGrouped(pParticles, 0);
+
+    #pragma omp parallel for num_threads(nThreads)
+    for(long b = 0; b < lBlocks; ++b) {
+        long lStart = b * SMC_BLOCK_SIZE;
+        long lEnd = std::min<long>(lStart + SMC_BLOCK_SIZE, N);
+        arena::scope Scratch(GetArena());
+        if(!bGrouped && pMoves->HasMoveBlock()) {
+            pMoves->DoMoveBlock(T + 1, pParticles.CheckoutRange(lStart, lEnd), lEnd - lStart, GetStream(STREAM_MOVE_BLOCK, lStart));
+            pParticles.CheckinRange(lStart, lEnd);
+        } else if(!bGrouped) {
+            for(long i = lStart; i < lEnd; ++i) {
+                pMoves->DoMove(T + 1, pParticles.Checkout(i), GetStream(STREAM_MOVE, i));
+                pParticles.Checkin(i);
+            }
+        }
+        wBlocks[b].Add(dLogWeights + lStart, lEnd - lStart);
+    }
+
+    weightsum wTotal;
+    for(long b = 0; b < lBlocks; ++b)
+        wTotal.Merge(wBlocks[b]);
+
+    const double dMaxWeight = wTotal.GetMax();
+    dLogWeightSum = wTotal.GetLogSum() - dMaxWeight;
+    dLogNormaliser += dMaxWeight;
+    const double dScale = exp(-dLogWeightSum);
+    dNormalisedWeights.resize(N);
+
+    #pragma omp parallel for num_threads(nThreads)
+    for(long i = 0; i < N; ++i) {
+        dLogWeights[i] -= dMaxWeight;
+        dNormalisedWeights[i] = exp(dLogWeights[i]) * dScale;
+    }
+    bWeightsCurrent = true;
+
+    return wTotal.GetESS();
+}
+
 ///Perform resampling.
 ///Note: this procedure sets all particle weights to zero after resampling.
 ///\param lMode The sampling mode for the sampler.
-template <class Space>
-void sampler<Space>::Resample(ResampleType lMode)
+template <class Space, class Rng, class Moveset>
+void sampler<Space, Rng, Moveset>::Resample(ResampleType lMode)
 {
-    //Resampling is done in place.
-    double dWeightSum = 0;
+    //Resampling is done in place unless it is double buffered.
     unsigned uMultinomialCount;
+    const double* dWeights;
 
     //First obtain a count of the number of children each particle has via the chosen strategy.
     //This will be stored in uRSCount.
     switch(lMode) {
     case SMC_RESAMPLE_MULTINOMIAL:
         //Sample from a suitable multinomial vector
+        //Draw N sorted indices with the normalised weights and count the occurrences of each in uRSCount
+        MultinomialIndices(N, N, GetNormalisedWeights(), uRSIndices.data(), dRSSpacings.data(), dRSCumulative.data());
         for(int i = 0; i < N; ++i)
-            dRSWeights[i] = pParticles[i].GetWeight();
-        //Generate a multinomial random vector with parameters (N,dRSWeights[1:N]) and store it in uRSCount
-        pRng->Multinomial(N, N, dRSWeights.data(), uRSCount.data());
+            uRSCount[i] = 0;
+        for(int j = 0; j < N; ++j)
+            uRSCount[uRSIndices[j]]++;
         break;
 
     case SMC_RESAMPLE_RESIDUAL:
         //Sample from a suitable multinomial vector and add the integer replicate
         //counts afterwards.
-        dWeightSum = 0;
-        for(int i = 0; i < N; ++i) {
-            dRSWeights[i] = pParticles[i].GetWeight();
-            dWeightSum += dRSWeights[i];
-        }
-
         uMultinomialCount = N;
+        dWeights = GetNormalisedWeights();
         for(int i = 0; i < N; ++i) {
-            dRSWeights[i] = N * dRSWeights[i] / dWeightSum;
-            uRSIndices[i] = unsigned(floor(dRSWeights[i])); //Reuse temporary storage.
-            dRSWeights[i] = (dRSWeights[i] - uRSIndices[i]);
-            uMultinomialCount -= uRSIndices[i];
+            dRSWeights[i] = N * dWeights[i];
+            uRSCount[i] = unsigned(floor(dRSWeights[i]));
+            dRSWeights[i] = (dRSWeights[i] - uRSCount[i]);
+            uMultinomialCount -= uRSCount[i];
+        }
+        //Draw uMultinomialCount sorted indices with weights dRSWeights[1:N] and add them to the counts in uRSCount
+        if(uMultinomialCount > 0) {
+            MultinomialIndices(uMultinomialCount, N, dRSWeights.data(), uRSIndices.data(), dRSSpacings.data(), dRSCumulative.data());
+            for(unsigned j = 0; j < uMultinomialCount; ++j)
+                uRSCount[uRSIndices[j]]++;
         }
-        //Generate a multinomial random vector with parameters (uMultinomialCount,dRSWeights[1:N]) and store it in uRSCount
-        pRng->Multinomial(uMultinomialCount, N, dRSWeights.data(), uRSCount.data());
-        for(int i = 0; i < N; ++i)
-            uRSCount[i] += uRSIndices[i];
         break;
 
 
     case SMC_RESAMPLE_STRATIFIED:
-    default: {
+    default:
         // Procedure for stratified sampling
         // See Appendix of Kitagawa 1996, http://www.jstor.org/stable/1390750,
         // or p.290 of the Doucet et al book, an image of which is at:
         // http://cl.ly/image/200T0y473k1d/stratified_resampling.jpg
-        dWeightSum = 0;
-        double dWeightCumulative = 0;
-        // Calculate the normalising constant of the weight vector
-        for(int i = 0; i < N; i++)
-            dWeightSum += exp(pParticles[i].GetLogWeight());
-        //Generate a random number between 0 and 1/N.
-        double dRand = pRng->Uniform(0, 1.0 / ((double)N));
-        // Clear out uRSCount.
-        for(int i = 0; i < N; ++i)
-            uRSCount[i] = 0;
-        // 0 <= j < N will index the current sampling step, whereas k will index the previous step.
-        int j = 0, k = 0;
-        // dWeightCumulative is \tilde{\pi}^r from the Doucet book.
-        dWeightCumulative = exp(pParticles[0].GetLogWeight()) / dWeightSum;
-        // Advance j along until dWeightCumulative > j/N + dRand
-        while(j < N) {
-            while((dWeightCumulative - dRand) > ((double)j) / ((double)N) && j < N) {
-                uRSCount[k]++; // Accept the particle k.
-                j++;
-                dRand = pRng->Uniform(0, 1.0 / ((double)N));
-            }
-            k++;
-            dWeightCumulative += exp(pParticles[k].GetLogWeight()) / dWeightSum;
-        }
+        dWeights = GetNormalisedWeights();
+        std::copy(dWeights, dWeights + N, dRSCumulative.data());
+        //Generate N random numbers between 0 and 1/N, one for each stratum.
+        pRng->UniformBatch(dRSUniforms.data(), N, 0, 1.0 / ((double)N));
+        SystematicCounts(N, N, dRSCumulative.data(), dRSUniforms.data(), true, uRSCount.data());
         break;
-    }
 
-    case SMC_RESAMPLE_SYSTEMATIC: {
+    case SMC_RESAMPLE_SYSTEMATIC:
         // Procedure for stratified sampling but with a common RV for each stratum
-        dWeightSum = 0;
-        double dWeightCumulative = 0;
-        // Calculate the normalising constant of the weight vector
-        for(int i = 0; i < N; i++)
-            dWeightSum += exp(pParticles[i].GetLogWeight());
-        //Generate a random number between 0 and 1/N times the sum of the weights
-        double dRand = pRng->Uniform(0, 1.0 / ((double)N));
-
-        int j = 0, k = 0;
-        for(int i = 0; i < N; ++i)
-            uRSCount[i] = 0;
-
-        dWeightCumulative = exp(pParticles[0].GetLogWeight()) / dWeightSum;
-        while(j < N) {
-            while((dWeightCumulative - dRand) > ((double)j) / ((double)N) && j < N) {
-                uRSCount[k]++;
-                j++;
-
-            }
-            k++;
-            dWeightCumulative += exp(pParticles[k].GetLogWeight()) / dWeightSum;
-        }
+        dWeights = GetNormalisedWeights();
+        std::copy(dWeights, dWeights + N, dRSCumulative.data());
+        //Generate a random number between 0 and 1/N
+        dRSUniforms[0] = pRng->Uniform(0, 1.0 / ((double)N));
+        SystematicCounts(N, N, dRSCumulative.data(), dRSUniforms.data(), false, uRSCount.data());
         break;
-
-    }
     }
 
     //Map count to indices to allow in-place resampling.
-    //Here j represents the next particle from the previous generation that is going to be dropped in the current
-    //sample, and thus can get filled by the resampling scheme.
-    for(unsigned int i = 0, j = 0; i < N; ++i) {
-        if(uRSCount[i] > 0) {
-            uRSIndices[i] = i;
-            while(uRSCount[i] > 1) {
-                while(uRSCount[j] > 0) ++j; // find next free spot
-                uRSIndices[j++] = i; // assign index
-                --uRSCount[i]; // decrement number of remaining offsprings
-            }
-        }
-    }
+    CountsToIndices(N, uRSCount.data(), uRSIndices.data(), uRSFree.data());
 
-#ifdef SMCTC_HAVE_BGL
-    UpdateParticleGraph(uRSIndices.data());
-#endif
+    //Trace the ancestry of the new particles back to the most recently stored generation.
+    for(int i = 0; i < N; ++i)
+        uRSFree[i] = uAncestors[uRSIndices[i]];
+    uAncestors.swap(uRSFree);
 
     //Perform the replication of the chosen.
-    for(unsigned int i = 0; i < N ; ++i) {
-        if(uRSIndices[i] != i)
-            pParticles[i].SetValue(pParticles[uRSIndices[i]].GetValue());
-        //Reset the log weight of the particles to be zero.
-        pParticles[i].SetLogWeight(0);
+    if(bDoubleBuffer) {
+        //Every particle is written once, so the gather is parallel; the spare population keeps its storage.
+        pSpare.resize(N);
+	#pragma omp parallel for num_threads(nThreads)
+        for(long i = 0; i < N; ++i)
+            pSpare.CopyValue(i, pParticles, uRSIndices[i]);
+        pParticles.swap(pSpare);
+        //Shared values are released so that the particles which now hold them are not made to clone them.
+        if(shared_values<Space>::value)
+            pSpare.clear();
+    } else {
+        for(unsigned int i = 0; i < N ; ++i) {
+            if(uRSIndices[i] != i)
+                pParticles.CopyValue(i, uRSIndices[i]);
+        }
     }
+    //Reset the log weight of the particles to be zero.
+    SetUniformWeights();
+}
+
+/// Each iteration of IterateEssVariable generates particles until the effective sample size reaches the resampling
+/// threshold or the number of particles reaches this limit, and then resamples them to the size of the population.
+///
+/// \param lMax The largest number of particles, which must be at least one.
+template <class Space, class Rng, class Moveset>
+void sampler<Space, Rng, Moveset>::SetMaxParticles(long lMax)
+{
+    if(lMax < 1)
+        throw SMC_EXCEPTION(SMCX_INVALID_PARAMETER, "The largest number of particles must be at least one.");
+    lMaxParticles = lMax;
 }
 
 /// This function configures the resampling parameters, allowing the specification of both the resampling
@@ -840,8 +1399,8 @@ void sampler<Space>::Resample(ResampleType lMode)
 /// The dThreshold parameter can be set to a value in the range [0,1) corresponding to a fraction of the size of
 /// the particle set or it may be set to an integer corresponding to an actual effective sample size.
 
-template <class Space>
-void sampler<Space>::SetResampleParams(ResampleType rtMode, double dThreshold)
+template <class Space, class Rng, class Moveset>
+void sampler<Space, Rng, Moveset>::SetResampleParams(ResampleType rtMode, double dThreshold)
 {
     rtResampleMode = rtMode;
     if(dThreshold < 1)
@@ -850,51 +1409,394 @@ void sampler<Space>::SetResampleParams(ResampleType rtMode, double dThreshold)
         dResampleThreshold = dThreshold;
 }
 
-template <class Space>
-std::ostream & sampler<Space>::StreamParticle(std::ostream & os, long n)
+template <class Space, class Rng, class Moveset>
+std::ostream & sampler<Space, Rng, Moveset>::StreamParticle(std::ostream & os, long n)
 {
-    os << pParticles[n] << std::endl;
+    particle<Space> pCopy = pParticles.GetParticle(n);
+    os << pCopy << std::endl;
     return os;
 }
 
-template <class Space>
-std::ostream & sampler<Space>::StreamParticles(std::ostream & os)
+template <class Space, class Rng, class Moveset>
+std::ostream & sampler<Space, Rng, Moveset>::StreamParticles(std::ostream & os)
 {
-    for(int i = 0; i < N - 1; i++)
-        os << pParticles[i] << std::endl;
-    os << pParticles[N - 1] << std::endl;
+    for(int i = 0; i < N; i++)
+        StreamParticle(os, i);
 
     return os;
 }
 
-#ifdef SMCTC_HAVE_BGL
-template <class Space>
-std::ostream & sampler<Space>::StreamParticleGraph(std::ostream & os) const
+/// Each thread which takes part in the parallel loops needs a generator of its own; they all share the same key, so the
+/// numbers which a particle receives depend only upon the key, the evolution time and the particle's index.
+///
+/// \param n The number of threads which will be used
+template <class Space, class Rng, class Moveset>
+void sampler<Space, Rng, Moveset>::AllocateStreams(size_t n)
 {
-    boost::write_graphviz(os, this->g);
-    return os;
+    if(n < 1)
+        n = 1;
+    pStreams.resize(n);
+    pArenas.resize(n);
+    for(size_t i = 0; i < n; ++i) {
+        if(!pStreams[i])
+            pStreams[i].reset(Rng::NewStream(lStreamSeed));
+        if(!pArenas[i])
+            pArenas[i].reset(new arena());
+    }
 }
 
-template <class Space>
-void sampler<Space>::UpdateParticleGraph(const unsigned int* parents)
+/// The parallel regions of the sampler have at most nThreads threads, so the thread number identifies one of its
+/// arenas. Outside them the thread number is that of the caller, which may be in a team of its own, so the code there
+/// uses the first arena instead.
+template <class Space, class Rng, class Moveset>
+arena & sampler<Space, Rng, Moveset>::GetArena(void) const
 {
-    const Vertex root(0, 0);
-    if(T == 0) {
-        // Initial particles - add each to the graph with no parent.
-        for(size_t i = 0; i < N; ++i)
-            boost::add_vertex(Vertex(T + 1, i), g);
-    } else {
-        // Add an edge between each particle and its parent
-        for(size_t i = 0; i < N; ++i) {
-            const Vertex u = T == 0 ? root : Vertex(T, parents == nullptr ? i : parents[i]);
-            const Vertex v = Vertex(T + 1, i);
-            assert(boost::vertex_by_label(u, g) != boost::graph_traits<Graph>::null_vertex() &&
-                   "Cannot find vertex!");
-            boost::add_vertex(v, g);
-            boost::add_edge_by_label(u, v, g);
+#if defined(_OPENMP)
+    return *pArenas[omp_get_thread_num()];
+#else
+    return *pArenas[0];
+#endif
+}
+
+/// The random numbers used to move or to apply MCMC to particle lIndex at a given time are drawn from a stream
+/// identified by (key, time, phase, lIndex). This makes the output independent of the number of threads in use and of
+/// the order in which they happen to process the particles. The epoch is the evolution time for the moves; operations
+/// which may be carried out more than once per iteration draw a fresh epoch from the master generator instead.
+///
+/// \param nPhase The stage of the iteration which will use the stream
+/// \param lEpoch The epoch within which the stream is used
+/// \param lIndex The index of the particle which will use the stream
+template <class Space, class Rng, class Moveset>
+Rng* sampler<Space, Rng, Moveset>::GetStream(StreamPhase nPhase, unsigned long lEpoch, long lIndex) const
+{
+#if defined(_OPENMP)
+    Rng* pStream = pStreams[omp_get_thread_num()].get();
+#else
+    Rng* pStream = pStreams[0].get();
+#endif
+    pStream->SetStream(STREAM_PHASES * lEpoch + nPhase, lIndex);
+    return pStream;
+}
+
+/// The scan is carried out in three steps: each block of SMC_BLOCK_SIZE elements is scanned in parallel, the block
+/// totals are scanned serially, and the offsets which result are added to the blocks in parallel. The order in which
+/// values are combined depends only upon K, so the result is independent of the number of threads.
+///
+/// \param K The number of values.
+/// \param pValues The values, which are replaced by their inclusive prefix sums.
+template <class Space, class Rng, class Moveset>
+template <class Value>
+void sampler<Space, Rng, Moveset>::InclusiveScan(long K, Value* pValues) const
+{
+    const long lBlocks = (K + SMC_BLOCK_SIZE - 1) / SMC_BLOCK_SIZE;
+    std::vector<Value> tBlockOffset(lBlocks + 1, Value(0));
+
+    #pragma omp parallel for num_threads(nThreads)
+    for(long b = 0; b < lBlocks; ++b) {
+        long lStart = b * SMC_BLOCK_SIZE;
+        long lEnd = std::min<long>(lStart + SMC_BLOCK_SIZE, K);
+        for(long i = lStart + 1; i < lEnd; ++i)
+            pValues[i] += pValues[i - 1];
+        tBlockOffset[b + 1] = pValues[lEnd - 1];
+    }
+    for(long b = 0; b < lBlocks; ++b)
+        tBlockOffset[b + 1] += tBlockOffset[b];
+
+    #pragma omp parallel for num_threads(nThreads)
+    for(long b = 1; b < lBlocks; ++b) {
+        long lStart = b * SMC_BLOCK_SIZE;
+        long lEnd = std::min<long>(lStart + SMC_BLOCK_SIZE, K);
+        for(long i = lStart; i < lEnd; ++i)
+            pValues[i] += tBlockOffset[b];
+    }
+}
+
+/// Stratified and systematic resampling select particle k once for each stratum j (0 <= j < M) for which the
+/// cumulative weight of the particles before k is at most j/M + u_j and that including k exceeds it, where u_j is
+/// uniform on [0, 1/M) and is common to all strata in the systematic case.
+///
+/// The number of strata which precede particle k can be found by bisection given only the cumulative weights, so
+/// after a parallel scan of the weights each block of particles locates its first stratum independently and then
+/// counts its offspring with the usual merge. For the same uniforms this gives the same counts as a serial merge.
+///
+/// \param M The number of particles to draw.
+/// \param K The number of particles to draw from.
+/// \param dCumulative On entry the (unnormalised) weights of the K particles; on exit their normalised cumulative weights.
+/// \param dUniforms The uniform variates on [0, 1/M): M of them if bStratified is set, one otherwise.
+/// \param bStratified Whether each stratum has its own uniform variate.
+/// \param uCount An array of K elements in which the offspring counts are returned.
+template <class Space, class Rng, class Moveset>
+void sampler<Space, Rng, Moveset>::SystematicCounts(long M, long K, double* dCumulative, const double* dUniforms, bool bStratified, unsigned int* uCount) const
+{
+    InclusiveScan(K, dCumulative);
+
+    //Normalise; dividing the total by itself ensures that the final cumulative weight is exactly one.
+    const double dWeightSum = dCumulative[K - 1];
+    #pragma omp parallel for num_threads(nThreads)
+    for(long k = 0; k < K; ++k)
+        dCumulative[k] /= dWeightSum;
+
+    //Stratum j accepts any particle whose cumulative weight c satisfies c - u_j > j/M.
+    struct accepts {
+        const double* dUniforms;
+        bool bStratified;
+        long M;
+        bool operator()(double c, long j) const {
+            return (c - dUniforms[bStratified ? j : 0]) > ((double)j) / ((double)M);
+        }
+    } Accepts = { dUniforms, bStratified, M };
+
+    //Any strata left over due to rounding are assigned to the last particle with positive weight.
+    long kLast = K - 1;
+    while(kLast > 0 && dCumulative[kLast] == dCumulative[kLast - 1])
+        --kLast;
+
+    const long lBlocks = (K + SMC_BLOCK_SIZE - 1) / SMC_BLOCK_SIZE;
+
+    #pragma omp parallel for num_threads(nThreads)
+    for(long b = 0; b < lBlocks; ++b) {
+        long lStart = b * SMC_BLOCK_SIZE;
+        long lEnd = std::min<long>(lStart + SMC_BLOCK_SIZE, K);
+
+        //Find the first stratum not accepted by the particles preceding this block.
+        long j = 0;
+        if(lStart > 0) {
+            long jHigh = M;
+            double c = dCumulative[lStart - 1];
+            while(j < jHigh) {
+                long jMid = j + (jHigh - j) / 2;
+                if(Accepts(c, jMid))
+                    j = jMid + 1;
+                else
+                    jHigh = jMid;
+            }
+        }
+
+        for(long k = lStart; k < lEnd; ++k) {
+            unsigned int uChildren = 0;
+            while(j < M && Accepts(dCumulative[k], j)) {
+                ++uChildren;
+                ++j;
+            }
+            if(k == kLast) {
+                uChildren += M - j;
+                j = M;
+            }
+            uCount[k] = uChildren;
         }
     }
 }
+
+/// The in-place replication performed by Resample requires that every particle with offspring keeps its own position
+/// and that the additional copies fill, in order, the positions of the particles which have none. Once the positions
+/// without offspring have been enumerated by a parallel scan, the m-th additional copy is placed in the m-th such
+/// position, which gives exactly the assignment of a serial left-to-right search for free positions.
+///
+/// \param K The number of particles.
+/// \param uCount The number of offspring of each particle; the counts sum to K.
+/// \param uIndices An array of K elements in which the parent of each position is returned.
+/// \param uFree Workspace of K elements.
+template <class Space, class Rng, class Moveset>
+void sampler<Space, Rng, Moveset>::CountsToIndices(long K, const unsigned int* uCount, unsigned int* uIndices, unsigned int* uFree) const
+{
+    const long lBlocks = (K + SMC_BLOCK_SIZE - 1) / SMC_BLOCK_SIZE;
+    std::vector<long> lFreeOffset(lBlocks + 1, 0), lExtraOffset(lBlocks + 1, 0);
+
+    #pragma omp parallel for num_threads(nThreads)
+    for(long b = 0; b < lBlocks; ++b) {
+        long lStart = b * SMC_BLOCK_SIZE;
+        long lEnd = std::min<long>(lStart + SMC_BLOCK_SIZE, K);
+        long lFree = 0, lExtra = 0;
+        for(long i = lStart; i < lEnd; ++i) {
+            if(uCount[i] == 0)
+                ++lFree;
+            else
+                lExtra += uCount[i] - 1;
+        }
+        lFreeOffset[b + 1] = lFree;
+        lExtraOffset[b + 1] = lExtra;
+    }
+    for(long b = 0; b < lBlocks; ++b) {
+        lFreeOffset[b + 1] += lFreeOffset[b];
+        lExtraOffset[b + 1] += lExtraOffset[b];
+    }
+
+    //Enumerate the free positions.
+    #pragma omp parallel for num_threads(nThreads)
+    for(long b = 0; b < lBlocks; ++b) {
+        long lStart = b * SMC_BLOCK_SIZE;
+        long lEnd = std::min<long>(lStart + SMC_BLOCK_SIZE, K);
+        long f = lFreeOffset[b];
+        for(long i = lStart; i < lEnd; ++i)
+            if(uCount[i] == 0)
+                uFree[f++] = i;
+    }
+
+    //Keep the survivors in place and send their additional copies to the free positions.
+    #pragma omp parallel for num_threads(nThreads)
+    for(long b = 0; b < lBlocks; ++b) {
+        long lStart = b * SMC_BLOCK_SIZE;
+        long lEnd = std::min<long>(lStart + SMC_BLOCK_SIZE, K);
+        long e = lExtraOffset[b];
+        for(long i = lStart; i < lEnd; ++i) {
+            if(uCount[i] > 0) {
+                uIndices[i] = i;
+                for(unsigned int c = 1; c < uCount[i]; ++c)
+                    uIndices[uFree[e++]] = i;
+            }
+        }
+    }
+}
+
+/// \param K The number of particles.
+/// \param uCount The number of offspring of each particle.
+/// \param uIndices An array, with as many elements as there are offspring, in which their parents are returned.
+template <class Space, class Rng, class Moveset>
+void sampler<Space, Rng, Moveset>::CountsToSortedIndices(long K, const unsigned int* uCount, unsigned int* uIndices) const
+{
+    const long lBlocks = (K + SMC_BLOCK_SIZE - 1) / SMC_BLOCK_SIZE;
+    std::vector<long> lOffset(lBlocks + 1, 0);
+
+    #pragma omp parallel for num_threads(nThreads)
+    for(long b = 0; b < lBlocks; ++b) {
+        long lStart = b * SMC_BLOCK_SIZE;
+        long lEnd = std::min<long>(lStart + SMC_BLOCK_SIZE, K);
+        long lTotal = 0;
+        for(long i = lStart; i < lEnd; ++i)
+            lTotal += uCount[i];
+        lOffset[b + 1] = lTotal;
+    }
+    for(long b = 0; b < lBlocks; ++b)
+        lOffset[b + 1] += lOffset[b];
+
+    #pragma omp parallel for num_threads(nThreads)
+    for(long b = 0; b < lBlocks; ++b) {
+        long lStart = b * SMC_BLOCK_SIZE;
+        long lEnd = std::min<long>(lStart + SMC_BLOCK_SIZE, K);
+        long j = lOffset[b];
+        for(long i = lStart; i < lEnd; ++i)
+            for(unsigned int c = 0; c < uCount[i]; ++c)
+                uIndices[j++] = i;
+    }
+}
+
+/// The normalised weights, and the logarithm of the sum of the unnormalised weights, are computed in a single pass
+/// over the log weights and are then reused by every subsequent reader (GetESS, Integrate and the resamplers) until
+/// a move, an MCMC step which alters a weight, or resampling changes the log weights again.
+template <class Space, class Rng, class Moveset>
+const double* sampler<Space, Rng, Moveset>::GetNormalisedWeights(void) const
+{
+    if(!bWeightsCurrent) {
+        dNormalisedWeights.resize(pParticles.size());
+        dLogWeightSum = NormalisedWeights(pParticles.GetLogWeights(), pParticles.size(), dNormalisedWeights.data());
+        bWeightsCurrent = true;
+    }
+    return dNormalisedWeights.data();
+}
+
+/// The normalised weights of equally weighted particles are known, so they are set along with the log weights and
+/// need not be recomputed.
+template <class Space, class Rng, class Moveset>
+void sampler<Space, Rng, Moveset>::SetUniformWeights(void)
+{
+    const long lSize = pParticles.size();
+    double* dLogWeights = pParticles.GetLogWeights();
+    dNormalisedWeights.resize(lSize);
+    for(long i = 0; i < lSize; ++i) {
+        dLogWeights[i] = 0;
+        dNormalisedWeights[i] = 1.0 / lSize;
+    }
+    dLogWeightSum = log((double)lSize);
+    bWeightsCurrent = true;
+}
+
+/// This function draws M indices from the multinomial distribution over {0, ..., K-1} with probabilities proportional
+/// to dWeights, in linear time. It does so by generating the order statistics of M uniform random variables directly,
+/// as normalised partial sums of M+1 exponential random variables, and merging them against the cumulative weights.
+///
+/// The exponential variates are drawn in blocks of SMC_BLOCK_SIZE, each from its own random number stream within an
+/// epoch drawn from the master generator, so both the generation and the merge run in parallel while the output is
+/// independent of the number of threads.
+///
+/// \param M The number of indices to draw.
+/// \param K The number of categories.
+/// \param dWeights The (unnormalised) weights of the categories.
+/// \param uIndices An array of M elements in which the indices are returned in increasing order.
+/// \param dSpacings Workspace of M+1 elements.
+/// \param dCumulative Workspace of K elements.
+template <class Space, class Rng, class Moveset>
+void sampler<Space, Rng, Moveset>::MultinomialIndices(long M, long K, const double* dWeights, unsigned int* uIndices, double* dSpacings, double* dCumulative) const
+{
+    const long lBlocks = (M + 1 + SMC_BLOCK_SIZE - 1) / SMC_BLOCK_SIZE;
+    const unsigned long lEpoch = (unsigned long)(pRng->UniformS() * 4294967296.0);
+    std::vector<double> dBlockOffset(lBlocks + 1);
+
+    //Generate the exponential spacings and their partial sums within each block.
+    #pragma omp parallel for num_threads(nThreads)
+    for(long b = 0; b < lBlocks; ++b) {
+        long lStart = b * SMC_BLOCK_SIZE;
+        long lLength = std::min<long>(SMC_BLOCK_SIZE, M + 1 - lStart);
+        GetStream(STREAM_RESAMPLE, lEpoch, b)->ExponentialBatch(dSpacings + lStart, lLength, 1.0);
+        for(long j = lStart + 1; j < lStart + lLength; ++j)
+            dSpacings[j] += dSpacings[j - 1];
+        dBlockOffset[b + 1] = dSpacings[lStart + lLength - 1];
+    }
+    for(long b = 0; b < lBlocks; ++b)
+        dBlockOffset[b + 1] += dBlockOffset[b];
+
+    //The cumulative weights against which the sorted uniforms are merged.
+    std::copy(dWeights, dWeights + K, dCumulative);
+    InclusiveScan(K, dCumulative);
+
+    //The j-th sorted uniform, scaled by the total weight, is dSpacings[j] * dScale once the offset of its block is added.
+    const double dScale = dCumulative[K - 1] / dBlockOffset[lBlocks];
+
+    #pragma omp parallel for num_threads(nThreads)
+    for(long b = 0; b < lBlocks; ++b) {
+        long lStart = b * SMC_BLOCK_SIZE;
+        long lEnd = std::min<long>(lStart + SMC_BLOCK_SIZE, M);
+        if(lStart >= lEnd)
+            continue;
+        //Locate the first index of this block by bisection, then merge linearly.
+        double dTarget = (dBlockOffset[b] + dSpacings[lStart]) * dScale;
+        long k = std::upper_bound(dCumulative, dCumulative + K, dTarget) - dCumulative;
+        for(long j = lStart; j < lEnd; ++j) {
+            dTarget = (dBlockOffset[b] + dSpacings[j]) * dScale;
+            while(k < K && dCumulative[k] <= dTarget)
+                ++k;
+            uIndices[j] = std::min(k, K - 1);
+        }
+    }
+}
+
+#ifdef SMCTC_GENEALOGY
+/// \param n The index of the particle
+/// \param lIndices The vector in which the index of the ancestor at each time, ending with n itself, is returned
+template <class Space, class Rng, class Moveset>
+void sampler<Space, Rng, Moveset>::GetParticleLineage(long n, std::vector<long> & lIndices) const
+{
+    Genealogy.GetLineage(n, lIndices);
+    for(size_t t = 0; t < lIndices.size(); ++t)
+        lIndices[t] = Genealogy.GetIndex(lIndices[t]);
+}
+
+template <class Space, class Rng, class Moveset>
+long sampler<Space, Rng, Moveset>::GetTimeToMRCA(void) const
+{
+    long lNode = Genealogy.GetMRCA();
+    if(lNode < 0)
+        return -1;
+    return Genealogy.GetLength() - 1 - Genealogy.GetGeneration(lNode);
+}
+
+/// The graph holds only the lineages which survive to the present, and is produced from the genealogy when this
+/// function is called.
+template <class Space, class Rng, class Moveset>
+std::ostream & sampler<Space, Rng, Moveset>::StreamParticleGraph(std::ostream & os) const
+{
+    Genealogy.StreamGraph(os);
+    return os;
+}
 #endif
 
 
@@ -906,8 +1808,8 @@ namespace std
 
 /// \param os The output stream to which the display should be made.
 /// \param s  The sampler which is to be displayed.
-template <class Space>
-std::ostream & operator<< (std::ostream & os, smc::sampler<Space> & s)
+template <class Space, class Rng, class Moveset>
+std::ostream & operator<< (std::ostream & os, smc::sampler<Space, Rng, Moveset> & s)
 {
     os << "Sampler Configuration:" << std::endl;
     os << "======================" << std::endl;
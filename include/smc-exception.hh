@@ -34,6 +34,14 @@
 #define SMCX_FILE_NOT_FOUND 0x0020
 ///Exception thrown if the sampler attempts to access history data which wasn't stored.
 #define SMCX_MISSING_HISTORY 0x0010
+///Exception thrown if a random number generator is asked to do something which its type does not support.
+#define SMCX_UNSUPPORTED_RNG 0x0040
+///Exception thrown if the history of the sampler cannot be stored in the requested manner.
+#define SMCX_UNSUPPORTED_HISTORY 0x0080
+///Exception thrown if the sampler is used before its moveset has been set.
+#define SMCX_MISSING_MOVESET 0x0100
+///Exception thrown if a parameter of the sampler is set to a value which it cannot take.
+#define SMCX_INVALID_PARAMETER 0x0200
 ///Exception thrown if an attempt is made to instantiate a class of which a single instance is permitted more than once.
 #define SMCX_MULTIPLE_INSTANTIATION 0x1000
 
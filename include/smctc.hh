@@ -101,6 +101,7 @@
 #include <gsl/gsl_rng.h>
 
 #include "smc-exception.hh"
+#include "fastrng.hh"
 #include "sampler.hh"
 
 /// The Sequential Monte Carlo namespace
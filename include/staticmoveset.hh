@@ -0,0 +1,173 @@
+//   SMCTC: staticmoveset.hh
+//
+//   This file is part of SMCTC.
+//
+//   SMCTC is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   SMCTC is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with SMCTC.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+//! \file
+//! \brief A set of sampler proposal "moves" whose functions are fixed at compile time.
+//!
+//! This file contains the smc::static_moveset class and the smc::make_moveset functions which create one. A
+//! static_moveset may be used by an smc::sampler in place of an smc::moveset by naming its type as the third template
+//! argument of the sampler.
+
+#ifndef __SMC_STATICMOVESET_HH
+#define __SMC_STATICMOVESET_HH 1.0
+
+#include <cstddef>
+#include <tuple>
+#include <type_traits>
+
+#include "particle.hh"
+#include "rng.hh"
+
+namespace smc
+{
+/// An MCMC move which leaves the particle unchanged, for use by static movesets which make no MCMC moves.
+struct no_mcmc {
+    template <class Particle, class Rng>
+    int operator()(long, Particle &, Rng*) const { return 0; }
+};
+
+/// A move selection function which always selects the first move, for use by static movesets with a single move.
+struct no_selection {
+    template <class Particle, class Rng>
+    long operator()(long, const Particle &, Rng*) const { return 0; }
+};
+
+/// Applies move n of a tuple of I moves, comparing n with each index in turn.
+template <std::size_t I, class Moves>
+struct move_dispatch {
+    template <class Particle, class Rng>
+    static void Apply(Moves & fMoves, long n, long lTime, Particle & pFrom, Rng* pRng)
+    {
+        if(n == (long)I - 1)
+            std::get<I - 1>(fMoves)(lTime, pFrom, pRng);
+        else
+            move_dispatch<I - 1, Moves>::Apply(fMoves, n, lTime, pFrom, pRng);
+    }
+};
+
+template <class Moves>
+struct move_dispatch<0, Moves> {
+    template <class Particle, class Rng>
+    static void Apply(Moves &, long, long, Particle &, Rng*) {}
+};
+
+/// A template class for a set of moves whose functions are template parameters.
+
+///    The initialisation, move selection, MCMC and move functions may be function objects of any type, including
+///    lambdas, with the same signatures as the corresponding smc::moveset callbacks. As the sampler calls them
+///    through their own types rather than through std::function, they can be inlined into the sampler's loops.
+///
+/// \tparam Space The class used to represent a point in the sample space.
+/// \tparam Rng The random number generator class.
+/// \tparam Init The type of the function which initialises a particle.
+/// \tparam Select The type of the function which selects a move for a given particle at a given time.
+/// \tparam MCMC The type of the MCMC move, which is applied the specified number of times.
+/// \tparam Moves The types of the moves.
+template <class Space, class Rng, class Init, class Select, class MCMC, class... Moves>
+class static_moveset
+{
+private:
+    ///The function which initialises a particle.
+    Init fInitialise;
+    ///The function which selects a move for a given particle at a given time.
+    Select fMoveSelect;
+    ///The Markov Chain Monte Carlo move.
+    MCMC fMCMC;
+    ///The functions which perform actual moves.
+    std::tuple<Moves...> fMoves;
+    ///Number of MCMC moves to make
+    std::size_t nMCMC;
+
+public:
+    ///Create a moveset from the supplied functions, which makes one MCMC move if MCMC is not smc::no_mcmc.
+    static_moveset(Init fInit, Select fSelect, MCMC fNewMCMC, Moves... fNewMoves) :
+        fInitialise(fInit), fMoveSelect(fSelect), fMCMC(fNewMCMC), fMoves(fNewMoves...),
+        nMCMC(std::is_same<MCMC, no_mcmc>::value ? 0 : 1) {}
+
+    ///Initialise a particle
+    particle<Space> DoInit(Rng* pRng) { return fInitialise(pRng); }
+    ///Perform the MCMC moves on a particle; returns nonzero if any was accepted.
+    int DoMCMC(long lTime, particle<Space> & pFrom, Rng* pRng)
+    {
+        int nAccepted = 0;
+        for(std::size_t i = 0; i < nMCMC; i++)
+            nAccepted |= fMCMC(lTime, pFrom, pRng) ? 1 : 0;
+        return nAccepted;
+    }
+    ///Select an appropriate move at time lTime and apply it to pFrom
+    void DoMove(long lTime, particle<Space> & pFrom, Rng* pRng)
+    {
+        if(sizeof...(Moves) == 1)
+            std::get<0>(fMoves)(lTime, pFrom, pRng);
+        else
+            move_dispatch<sizeof...(Moves), std::tuple<Moves...> >::Apply(fMoves, fMoveSelect(lTime, pFrom, pRng), lTime, pFrom, pRng);
+    }
+
+    ///Returns the number of moves from which the move selection function chooses.
+    long GetNumberOfMoves(void) const { return sizeof...(Moves); }
+    ///Returns the index of the move which should be applied to pFrom at time lTime
+    long DoSelect(long lTime, const particle<Space> & pFrom, Rng* pRng)
+    { return sizeof...(Moves) > 1 ? fMoveSelect(lTime, pFrom, pRng) : 0; }
+    ///Apply move lMove to pFrom at time lTime
+    void DoMoveNumber(long lMove, long lTime, particle<Space> & pFrom, Rng* pRng)
+    { move_dispatch<sizeof...(Moves), std::tuple<Moves...> >::Apply(fMoves, lMove, lTime, pFrom, pRng); }
+
+    ///Returns false: the moves of a static moveset are applied to one particle at a time.
+    bool HasMoveBlock(void) const { return false; }
+    ///Returns false: the MCMC moves of a static moveset are applied to one particle at a time.
+    bool HasMCMCBlock(void) const { return false; }
+    ///Move the n particles starting at pFirst in turn, using pRng for all of them
+    void DoMoveBlock(long lTime, particle<Space>* pFirst, long n, Rng* pRng)
+    {
+        for(long i = 0; i < n; i++)
+            DoMove(lTime, pFirst[i], pRng);
+    }
+    ///Apply the MCMC moves to the n particles starting at pFirst in turn; returns the number which moved
+    long DoMCMCBlock(long lTime, particle<Space>* pFirst, long n, Rng* pRng)
+    {
+        long nMoved = 0;
+        for(long i = 0; i < n; i++)
+            nMoved += DoMCMC(lTime, pFirst[i], pRng);
+        return nMoved;
+    }
+
+    /// \brief Set the number of MCMC moves to make
+    /// \param n Number of moves to make
+    void SetNumberOfMCMCMoves(const std::size_t n) { nMCMC = n; }
+};
+
+/// \param fInit The function which should be used to initialise particles when the system is initialised
+/// \param fMove The function which moves a particle at a specified time to a new location
+template <class Space, class Rng = rng, class Init, class Move>
+static_moveset<Space, Rng, Init, no_selection, no_mcmc, Move> make_moveset(Init fInit, Move fMove)
+{
+    return static_moveset<Space, Rng, Init, no_selection, no_mcmc, Move>(fInit, no_selection(), no_mcmc(), fMove);
+}
+
+/// \param fInit The function which should be used to initialise particles when the system is initialised
+/// \param fSelect The function which selects a move to apply, at a specified time, to a specified particle
+/// \param fMCMC The MCMC move, or smc::no_mcmc() if there is none
+/// \param fMoves The functions which move a particle at a specified time to a new location
+template <class Space, class Rng = rng, class Init, class Select, class MCMC, class... Moves>
+static_moveset<Space, Rng, Init, Select, MCMC, Moves...> make_moveset(Init fInit, Select fSelect, MCMC fMCMC, Moves... fMoves)
+{
+    return static_moveset<Space, Rng, Init, Select, MCMC, Moves...>(fInit, fSelect, fMCMC, fMoves...);
+}
+}
+
+#endif
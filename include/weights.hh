@@ -0,0 +1,329 @@
+//   SMCTC: weights.hh
+//
+//   This file is part of SMCTC.
+//
+//   SMCTC is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   SMCTC is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with SMCTC.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+//! \file
+//! \brief Functions which operate upon arrays of log weights.
+//!
+//! This file contains the reductions over the log weights of a particle set which are needed at every iteration of a
+//! sampler: the maximum, the log-sum-exp, the normalised weights, the effective sample size and the conditional
+//! effective sample size. They operate upon contiguous arrays of doubles, such as smc::population::GetLogWeights,
+//! in loops which the compiler can vectorise, and use compensated summation in place of extended precision. It also
+//! contains smc::moments, which accumulates the weighted means and variances of statistics of the particles.
+
+#ifndef __SMC_WEIGHTS_HH
+#define __SMC_WEIGHTS_HH 1.0
+
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#ifndef SMC_SIMD_LANES
+///The number of independent partial sums used by the vectorised reductions.
+#define SMC_SIMD_LANES 8
+#endif
+
+namespace smc
+{
+/// A sum of doubles which carries the rounding error of each addition in a separate correction term.
+
+///    Each addition uses the error-free transformation of Knuth's TwoSum, which needs no branches, so the result is
+///    as accurate as if it had been accumulated in twice the working precision.
+class compensated_sum
+{
+private:
+    ///The running sum.
+    double dSum;
+    ///The accumulated rounding error of dSum.
+    double dCorrection;
+
+public:
+    compensated_sum() : dSum(0), dCorrection(0) {}
+
+    ///Add dValue to the sum.
+    void Add(double dValue)
+    {
+        double t = dSum + dValue;
+        double z = t - dSum;
+        dCorrection += (dSum - (t - z)) + (dValue - z);
+        dSum = t;
+    }
+    ///Add another compensated sum to this one.
+    void Add(const compensated_sum & sOther) { Add(sOther.dSum); Add(sOther.dCorrection); }
+    ///Multiply the sum by dFactor.
+    void Scale(double dFactor) { dSum *= dFactor; dCorrection *= dFactor; }
+    ///Returns the value of the sum.
+    double GetSum(void) const { return dSum + dCorrection; }
+};
+
+///Add each of the n terms fTerm(i) to S1 and its square to S2.
+
+///    The terms are spread over SMC_SIMD_LANES compensated partial sums, which are independent of one another and so
+///    can be held in the lanes of a vector register, and the partial sums are combined in a fixed order at the end.
+///     \param n The number of terms.
+///     \param fTerm A function returning term i.
+///     \param S1 The sum to which the terms are added.
+///     \param S2 The sum to which the squares of the terms are added.
+template <class Term>
+inline void AccumulateLanes(long n, Term fTerm, compensated_sum & S1, compensated_sum & S2)
+{
+    double s1[SMC_SIMD_LANES] = {0}, c1[SMC_SIMD_LANES] = {0};
+    double s2[SMC_SIMD_LANES] = {0}, c2[SMC_SIMD_LANES] = {0};
+
+    long i = 0;
+    for(; i + SMC_SIMD_LANES <= n; i += SMC_SIMD_LANES) {
+        #pragma omp simd
+        for(int l = 0; l < SMC_SIMD_LANES; ++l) {
+            double x = fTerm(i + l);
+            double t = s1[l] + x;
+            double z = t - s1[l];
+            c1[l] += (s1[l] - (t - z)) + (x - z);
+            s1[l] = t;
+            double xx = x * x;
+            t = s2[l] + xx;
+            z = t - s2[l];
+            c2[l] += (s2[l] - (t - z)) + (xx - z);
+            s2[l] = t;
+        }
+    }
+    for(int l = 0; l < SMC_SIMD_LANES; ++l) {
+        S1.Add(s1[l]);
+        S1.Add(c1[l]);
+        S2.Add(s2[l]);
+        S2.Add(c2[l]);
+    }
+    for(; i < n; ++i) {
+        double x = fTerm(i);
+        S1.Add(x);
+        S2.Add(x * x);
+    }
+}
+
+///Returns the largest of the n log weights in dLogWeights, or -infinity if n is zero.
+inline double LogWeightMax(const double* dLogWeights, long n)
+{
+    double dMax = -std::numeric_limits<double>::infinity();
+    #pragma omp simd reduction(max:dMax)
+    for(long i = 0; i < n; ++i)
+        dMax = dLogWeights[i] > dMax ? dLogWeights[i] : dMax;
+    return dMax;
+}
+
+/// An accumulator for the sum and the sum of squares of the weights of a set of particles.
+
+///    The sums are held relative to the largest log weight seen so far, and are rescaled whenever a larger one is
+///    added, so no weight can overflow. Accumulators for disjoint sets of particles can be merged, which allows a
+///    particle set to be reduced in blocks; merging the same blocks in the same order always gives the same result.
+class weightsum
+{
+private:
+    ///The largest log weight added so far.
+    double dMax;
+    ///The sum of exp(logweight - dMax).
+    compensated_sum S1;
+    ///The sum of exp(2 * (logweight - dMax)).
+    compensated_sum S2;
+
+    ///Express the sums relative to dNewMax, which must be at least dMax.
+    void Rebase(double dNewMax)
+    {
+        if(dNewMax > dMax) {
+            double dFactor = std::exp(dMax - dNewMax);
+            S1.Scale(dFactor);
+            S2.Scale(dFactor * dFactor);
+            dMax = dNewMax;
+        }
+    }
+
+public:
+    weightsum() : dMax(-std::numeric_limits<double>::infinity()) {}
+
+    ///Add the n log weights in dLogWeights.
+    void Add(const double* dLogWeights, long n)
+    {
+        Rebase(LogWeightMax(dLogWeights, n));
+        if(dMax == -std::numeric_limits<double>::infinity())
+            return;
+        const double dShift = dMax;
+        AccumulateLanes(n, [dLogWeights, dShift](long i) { return std::exp(dLogWeights[i] - dShift); }, S1, S2);
+    }
+    ///Add the particles summarised by another accumulator.
+    void Merge(const weightsum & wOther)
+    {
+        if(wOther.dMax == -std::numeric_limits<double>::infinity())
+            return;
+        Rebase(wOther.dMax);
+        compensated_sum T1 = wOther.S1, T2 = wOther.S2;
+        double dFactor = std::exp(wOther.dMax - dMax);
+        T1.Scale(dFactor);
+        T2.Scale(dFactor * dFactor);
+        S1.Add(T1);
+        S2.Add(T2);
+    }
+
+    ///Returns the largest log weight.
+    double GetMax(void) const { return dMax; }
+    ///Returns the natural logarithm of the sum of the weights.
+    double GetLogSum(void) const { return dMax + std::log(S1.GetSum()); }
+    ///Returns the effective sample size, (sum of weights)^2 / (sum of squared weights).
+    double GetESS(void) const { double s = S1.GetSum(); return s * s / S2.GetSum(); }
+};
+
+/// The weighted means and variances of a fixed number of statistics, accumulated in a single pass.
+
+///    Each observation updates the means and the weighted sums of squared deviations from them by Welford's method,
+///    as extended to weighted observations by West (1979), so the variances do not suffer the cancellation of the
+///    textbook formula. Accumulators for disjoint sets of particles are combined by the method of Chan, Golub and
+///    LeVeque (1979).
+class moments
+{
+private:
+    ///The sum of the weights added so far.
+    double dWeight;
+    ///The weighted mean of each statistic.
+    std::vector<double> dMean;
+    ///The weighted sum of the squared deviations of each statistic from its mean.
+    std::vector<double> dSquares;
+
+public:
+    ///Create an accumulator for K statistics.
+    explicit moments(long K) : dWeight(0), dMean(K, 0.0), dSquares(K, 0.0) {}
+
+    ///Add an observation of every statistic, dValues, with weight dW.
+    void Add(double dW, const double* dValues)
+    {
+        if(!(dW > 0))
+            return;
+        dWeight += dW;
+        const double dRatio = dW / dWeight;
+        for(size_t k = 0; k < dMean.size(); ++k) {
+            double dDelta = dValues[k] - dMean[k];
+            dMean[k] += dRatio * dDelta;
+            dSquares[k] += dW * dDelta * (dValues[k] - dMean[k]);
+        }
+    }
+    ///Add the observations summarised by another accumulator.
+    void Merge(const moments & mOther)
+    {
+        if(!(mOther.dWeight > 0))
+            return;
+        const double dTotal = dWeight + mOther.dWeight;
+        const double dRatio = mOther.dWeight / dTotal;
+        for(size_t k = 0; k < dMean.size(); ++k) {
+            double dDelta = mOther.dMean[k] - dMean[k];
+            dMean[k] += dRatio * dDelta;
+            dSquares[k] += mOther.dSquares[k] + dDelta * dDelta * dWeight * dRatio;
+        }
+        dWeight = dTotal;
+    }
+
+    ///Returns the sum of the weights.
+    double GetWeight(void) const { return dWeight; }
+    ///Returns the weighted mean of statistic k.
+    double GetMean(long k) const { return dMean[k]; }
+    ///Returns the weighted variance of statistic k.
+    double GetVariance(long k) const { return dSquares[k] / dWeight; }
+};
+
+///Returns log(sum(exp(dLogWeights[i]))) over the n log weights.
+inline double LogSumExp(const double* dLogWeights, long n)
+{
+    weightsum wSum;
+    wSum.Add(dLogWeights, n);
+    return wSum.GetLogSum();
+}
+
+///Returns the effective sample size of a particle set with the n log weights in dLogWeights.
+inline double EffectiveSampleSize(const double* dLogWeights, long n)
+{
+    weightsum wSum;
+    wSum.Add(dLogWeights, n);
+    return wSum.GetESS();
+}
+
+///Returns the effective sample size, 1 / sum(dWeights[i]^2), of a particle set with the n normalised weights in dWeights.
+inline double NormalisedESS(const double* dWeights, long n)
+{
+    compensated_sum S1, S2;
+    AccumulateLanes(n, [dWeights](long i) { return dWeights[i]; }, S1, S2);
+    return 1.0 / S2.GetSum();
+}
+
+///Write the normalised weights exp(dLogWeights[i]) / sum(exp(dLogWeights)) to dWeights.
+
+///    \param dLogWeights The n log weights.
+///    \param n The number of weights.
+///    \param dWeights An array of n elements in which the normalised weights are returned; it may be dLogWeights.
+///    \return The natural logarithm of the sum of the unnormalised weights.
+inline double NormalisedWeights(const double* dLogWeights, long n, double* dWeights)
+{
+    const double dMax = LogWeightMax(dLogWeights, n);
+    compensated_sum S1, S2;
+    AccumulateLanes(n, [dLogWeights, dWeights, dMax](long i) { return dWeights[i] = std::exp(dLogWeights[i] - dMax); }, S1, S2);
+    const double dScale = 1.0 / S1.GetSum();
+    #pragma omp simd
+    for(long i = 0; i < n; ++i)
+        dWeights[i] *= dScale;
+    return dMax + std::log(S1.GetSum());
+}
+
+///Subtract the largest of the n log weights from each of them, so that the largest weight becomes one.
+
+///    \return The log weight which was subtracted.
+inline double NormaliseLogWeights(double* dLogWeights, long n)
+{
+    const double dMax = LogWeightMax(dLogWeights, n);
+    #pragma omp simd
+    for(long i = 0; i < n; ++i)
+        dLogWeights[i] -= dMax;
+    return dMax;
+}
+
+///Returns the conditional effective sample size of Zhou, Johansen and Aston (2016).
+
+///    For a particle set with normalised weights W_i which is reweighted by incremental weights w_i, this is
+///    n (sum W_i w_i)^2 / (sum W_i w_i^2), which lies between 1 and n. It measures the quality of the reweighting
+///    step alone and is suitable for choosing the next distribution in an adaptive sequence.
+///    \param dLogWeights The n log weights before reweighting.
+///    \param dLogIncrements The n logarithms of the incremental weights.
+///    \param n The number of particles.
+inline double ConditionalESS(const double* dLogWeights, const double* dLogIncrements, long n)
+{
+    double m0 = -std::numeric_limits<double>::infinity(), m1 = m0, m2 = m0;
+    #pragma omp simd reduction(max:m0,m1,m2)
+    for(long i = 0; i < n; ++i) {
+        double a = dLogWeights[i], b = a + dLogIncrements[i], c = b + dLogIncrements[i];
+        m0 = a > m0 ? a : m0;
+        m1 = b > m1 ? b : m1;
+        m2 = c > m2 ? c : m2;
+    }
+
+    compensated_sum S0, S1, S2, Unused;
+    AccumulateLanes(n, [dLogWeights, m0](long i) { return std::exp(dLogWeights[i] - m0); }, S0, Unused);
+    AccumulateLanes(n, [dLogWeights, dLogIncrements, m1](long i) {
+        return std::exp(dLogWeights[i] + dLogIncrements[i] - m1);
+    }, S1, Unused);
+    AccumulateLanes(n, [dLogWeights, dLogIncrements, m2](long i) {
+        return std::exp(dLogWeights[i] + 2.0 * dLogIncrements[i] - m2);
+    }, S2, Unused);
+
+    double s1 = S1.GetSum();
+    return n * s1 * s1 / (S0.GetSum() * S2.GetSum()) * std::exp(2.0 * m1 - m0 - m2);
+}
+}
+
+#endif
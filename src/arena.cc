@@ -0,0 +1,71 @@
+#include "smctc.hh"
+
+#include <algorithm>
+#include <new>
+
+//! \file
+//! \brief This file contains the functions of the smc::arena class.
+
+namespace smc
+{
+thread_local arena* arena::pCurrent = 0;
+
+arena::arena() :
+    uCurrent(0), uUsed(0)
+{
+}
+
+arena::~arena()
+{
+    for(size_t i = 0; i < Chunks.size(); ++i)
+        ::operator delete(Chunks[i].pData);
+}
+
+/// The storage is taken from the current block if it fits, and otherwise from the next block which is large enough;
+/// a new block is obtained from the system only when no block is.
+///
+/// \param uBytes The number of bytes required.
+/// \param uAlign The alignment required, which must be a power of two no greater than that of std::max_align_t.
+void* arena::Allocate(size_t uBytes, size_t uAlign)
+{
+    while(uCurrent < Chunks.size()) {
+        size_t uStart = (uUsed + uAlign - 1) & ~(uAlign - 1);
+        if(uStart + uBytes <= Chunks[uCurrent].uSize) {
+            uUsed = uStart + uBytes;
+            return Chunks[uCurrent].pData + uStart;
+        }
+        ++uCurrent;
+        uUsed = 0;
+    }
+
+    chunk c;
+    c.uSize = std::max<size_t>(SMC_ARENA_CHUNK_SIZE, uBytes);
+    c.pData = static_cast<char*>(::operator new(c.uSize));
+    Chunks.push_back(c);
+    uCurrent = Chunks.size() - 1;
+    uUsed = uBytes;
+    return c.pData;
+}
+
+void arena::Reset(void)
+{
+    uCurrent = 0;
+    uUsed = 0;
+}
+
+size_t arena::GetCapacity(void) const
+{
+    size_t uCapacity = 0;
+    for(size_t i = 0; i < Chunks.size(); ++i)
+        uCapacity += Chunks[i].uSize;
+    return uCapacity;
+}
+
+arena & arena::Local(void)
+{
+    if(pCurrent)
+        return *pCurrent;
+    static thread_local arena Own;
+    return Own;
+}
+}
@@ -0,0 +1,93 @@
+#include "smctc.hh"
+
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+//! \file
+//! \brief This file contains the untemplated functions used for storing the history of the system on disk.
+
+namespace smc
+{
+historyfile::historyfile() :
+    pFile(0), lSize(0), pMap(0), lMapSize(0)
+{
+}
+
+historyfile::~historyfile()
+{
+    Close();
+}
+
+/// \param szPath The path of the file, or null to use an anonymous temporary file which is removed when closed.
+void historyfile::Open(const char* szPath)
+{
+    Close();
+
+    pFile = szPath ? std::fopen(szPath, "w+b") : std::tmpfile();
+    if(!pFile)
+        throw SMC_EXCEPTION(SMCX_FILE_NOT_FOUND, "The file in which the history is to be stored could not be opened.");
+
+    Buffer.resize(SMC_HISTORY_BUFFER_SIZE);
+    std::setvbuf(pFile, Buffer.data(), _IOFBF, Buffer.size());
+    lSize = 0;
+}
+
+void historyfile::Close(void)
+{
+    Unmap();
+    if(pFile)
+        std::fclose(pFile);
+    pFile = 0;
+    lSize = 0;
+}
+
+void historyfile::Unmap(void)
+{
+    if(pMap)
+        munmap(pMap, lMapSize);
+    pMap = 0;
+    lMapSize = 0;
+}
+
+/// \param pData The bytes to write.
+/// \param n The number of bytes to write.
+void historyfile::Write(const void* pData, size_t n)
+{
+    if(n && std::fwrite(pData, 1, n, pFile) != n)
+        throw SMC_EXCEPTION(SMCX_FILE_NOT_FOUND, "The history could not be written to disk.");
+    lSize += n;
+}
+
+/// The buffered data are written out before the file is mapped. The mapping is reused for as long as the file is
+/// not changed, and is replaced by a mapping of the whole file once it has been.
+const char* historyfile::Map(void)
+{
+    if(pMap && lMapSize == lSize)
+        return static_cast<const char*>(pMap);
+
+    Unmap();
+    if(lSize == 0)
+        return 0;
+
+    std::fflush(pFile);
+    pMap = mmap(0, lSize, PROT_READ, MAP_SHARED, fileno(pFile), 0);
+    if(pMap == MAP_FAILED) {
+        pMap = 0;
+        throw SMC_EXCEPTION(SMCX_FILE_NOT_FOUND, "The history file could not be mapped into memory.");
+    }
+    lMapSize = lSize;
+    return static_cast<const char*>(pMap);
+}
+
+/// \param lNewSize The number of bytes to keep.
+void historyfile::Truncate(long lNewSize)
+{
+    Unmap();
+    std::fflush(pFile);
+    if(ftruncate(fileno(pFile), lNewSize) != 0)
+        throw SMC_EXCEPTION(SMCX_FILE_NOT_FOUND, "The history file could not be truncated.");
+    std::fseek(pFile, lNewSize, SEEK_SET);
+    lSize = lNewSize;
+}
+}
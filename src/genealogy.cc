@@ -0,0 +1,135 @@
+#include "smctc.hh"
+
+#include <algorithm>
+
+//! \file
+//! \brief This file contains the functions of the smc::genealogy class.
+
+namespace smc
+{
+genealogy::genealogy()
+{
+    lGenerations = 0;
+}
+
+void genealogy::Clear(void)
+{
+    Nodes.clear();
+    lFree.clear();
+    lLeaves.clear();
+    lGenerations = 0;
+}
+
+/// \param lParent The identifier of the parent of the new node, or -1 if it has none.
+/// \param lIndex The index of the particle within the new generation.
+long genealogy::NewNode(long lParent, long lIndex)
+{
+    long lNode;
+    if(lFree.empty()) {
+        lNode = Nodes.size();
+        Nodes.push_back(node());
+    } else {
+        lNode = lFree.back();
+        lFree.pop_back();
+    }
+    Nodes[lNode].lParent = lParent;
+    Nodes[lNode].lGeneration = lGenerations;
+    Nodes[lNode].lIndex = lIndex;
+    Nodes[lNode].lChildren = 0;
+    if(lParent >= 0)
+        Nodes[lParent].lChildren++;
+    return lNode;
+}
+
+/// \param lNode The node to release, which must have no children.
+/// \param plReleased If not null, the identifiers of the released nodes are appended to this vector.
+void genealogy::Release(long lNode, std::vector<long>* plReleased)
+{
+    while(lNode >= 0 && Nodes[lNode].lChildren == 0) {
+        long lParent = Nodes[lNode].lParent;
+        Nodes[lNode].lGeneration = -1;
+        lFree.push_back(lNode);
+        if(plReleased)
+            plReleased->push_back(lNode);
+        if(lParent >= 0)
+            Nodes[lParent].lChildren--;
+        lNode = lParent;
+    }
+}
+
+/// The particles of the previous generation which are not the parent of any new particle are released, along with
+/// any of their ancestors which no longer have descendants in the new generation.
+///
+/// \param lNumber The number of particles in the new generation.
+/// \param uParents The index, within the previous generation, of the parent of each new particle. This is ignored
+/// for the first generation; null may be passed to indicate that particle i is the child of particle i.
+/// \param plReleased If not null, the identifiers of the released nodes are appended to this vector.
+void genealogy::Extend(long lNumber, const unsigned int* uParents, std::vector<long>* plReleased)
+{
+    std::vector<long> lParents;
+    lParents.swap(lLeaves);
+
+    lLeaves.resize(lNumber);
+    for(long i = 0; i < lNumber; ++i) {
+        long lParent = -1;
+        if(!lParents.empty())
+            lParent = lParents[uParents ? uParents[i] : i];
+        lLeaves[i] = NewNode(lParent, i);
+    }
+
+    for(size_t i = 0; i < lParents.size(); ++i)
+        Release(lParents[i], plReleased);
+
+    lGenerations++;
+}
+
+/// \param n The index of the particle within the most recent generation.
+/// \param lPath The vector in which the identifiers of the particle's ancestors, from the first generation to the
+/// particle itself, are returned.
+void genealogy::GetLineage(long n, std::vector<long> & lPath) const
+{
+    lPath.clear();
+    for(long lNode = lLeaves[n]; lNode >= 0; lNode = Nodes[lNode].lParent)
+        lPath.push_back(lNode);
+    std::reverse(lPath.begin(), lPath.end());
+}
+
+/// The lineages of the particles of the most recent generation are traced back together, one generation at a time,
+/// until they coalesce. As the tree holds no extinct branches, the number of steps is at most the number of nodes.
+long genealogy::GetMRCA(void) const
+{
+    std::vector<long> lCurrent(lLeaves);
+    std::sort(lCurrent.begin(), lCurrent.end());
+    lCurrent.erase(std::unique(lCurrent.begin(), lCurrent.end()), lCurrent.end());
+
+    while(lCurrent.size() > 1) {
+        for(size_t i = 0; i < lCurrent.size(); ++i) {
+            lCurrent[i] = Nodes[lCurrent[i]].lParent;
+            if(lCurrent[i] < 0)
+                return -1;
+        }
+        std::sort(lCurrent.begin(), lCurrent.end());
+        lCurrent.erase(std::unique(lCurrent.begin(), lCurrent.end()), lCurrent.end());
+    }
+
+    return lCurrent.empty() ? -1 : lCurrent[0];
+}
+
+/// Each node is labelled with its generation and its index within that generation, and an edge joins each node to
+/// its parent.
+///
+/// \param os The output stream to send the graph to.
+void genealogy::StreamGraph(std::ostream & os) const
+{
+    os << "digraph G {" << std::endl;
+    for(size_t n = 0; n < Nodes.size(); ++n) {
+        if(Nodes[n].lGeneration >= 0)
+            os << n << " [label=\"(" << Nodes[n].lGeneration << "," << Nodes[n].lIndex << ")\"];" << std::endl;
+    }
+    for(size_t n = 0; n < Nodes.size(); ++n) {
+        if(Nodes[n].lGeneration >= 0 && Nodes[n].lParent >= 0)
+            os << Nodes[n].lParent << "->" << n << " ;" << std::endl;
+    }
+    os << "}" << std::endl;
+}
+}
@@ -1,5 +1,6 @@
 #include <iostream>
 #include <cstring>
+#include <stdint.h>
 
 //! \file
 //! \brief This file contains the untemplated functions used for dealing with random number generation.
@@ -9,6 +10,81 @@
 
 namespace smc
 {
+///The state of a Philox4x32-10 generator: the key, the counter and the block of output most recently generated.
+typedef struct {
+    uint32_t key[2];
+    uint32_t ctr[4];
+    uint32_t out[4];
+    unsigned int pos;
+} philox_state_t;
+
+///This function applies the ten rounds of the Philox4x32 bijection to the counter of pState and stores the
+///result in its output block.
+static void philox_block(philox_state_t* pState)
+{
+    const uint32_t M0 = 0xD2511F53, M1 = 0xCD9E8D57;
+    const uint32_t W0 = 0x9E3779B9, W1 = 0xBB67AE85;
+
+    uint32_t c0 = pState->ctr[0], c1 = pState->ctr[1], c2 = pState->ctr[2], c3 = pState->ctr[3];
+    uint32_t k0 = pState->key[0], k1 = pState->key[1];
+
+    for(int r = 0; r < 10; r++) {
+        uint64_t p0 = (uint64_t)M0 * c0;
+        uint64_t p1 = (uint64_t)M1 * c2;
+        c0 = (uint32_t)(p1 >> 32) ^ c1 ^ k0;
+        c2 = (uint32_t)(p0 >> 32) ^ c3 ^ k1;
+        c1 = (uint32_t)p1;
+        c3 = (uint32_t)p0;
+        k0 += W0;
+        k1 += W1;
+    }
+    pState->out[0] = c0;
+    pState->out[1] = c1;
+    pState->out[2] = c2;
+    pState->out[3] = c3;
+    pState->pos = 0;
+
+    //Only the first counter word advances; the others identify the stream.
+    pState->ctr[0]++;
+}
+
+///Seeding a Philox generator sets its key and positions it at the start of stream zero.
+static void philox_set(void* vState, unsigned long lSeed)
+{
+    philox_state_t* pState = (philox_state_t*) vState;
+    uint64_t lKey = lSeed;
+
+    pState->key[0] = (uint32_t)lKey;
+    pState->key[1] = (uint32_t)(lKey >> 32);
+    pState->ctr[0] = pState->ctr[1] = pState->ctr[2] = pState->ctr[3] = 0;
+    pState->pos = 4;
+}
+
+static unsigned long philox_get(void* vState)
+{
+    philox_state_t* pState = (philox_state_t*) vState;
+    if(pState->pos == 4)
+        philox_block(pState);
+    return pState->out[pState->pos++];
+}
+
+static double philox_get_double(void* vState)
+{
+    return philox_get(vState) / 4294967296.0;
+}
+
+static const gsl_rng_type philox4x32_type = {
+    "philox4x32",
+    0xffffffffUL,
+    0,
+    sizeof(philox_state_t),
+    &philox_set,
+    &philox_get,
+    &philox_get_double
+};
+
+const gsl_rng_type* rng_philox4x32 = &philox4x32_type;
+
 ///The GSL provides a mechanism for obtaining a list of available random number generators.
 ///
 ///This class provides a wrapper for this mechanism and makes it simple to implement software which allows
@@ -121,6 +197,36 @@ rng::~rng()
     gsl_rng_free(pWorkspace);
 }
 
+///This function allocates a new Philox4x32 generator keyed by the supplied seed. Each of its streams may then be
+///selected in constant time using SetStream; the streams of two generators with the same key are identical.
+///
+///\param lSeed The key of the generator
+rng* rng::NewStream(unsigned long lSeed)
+{
+    return new rng(rng_philox4x32, lSeed);
+}
+
+///This function repositions a counter-based generator at the start of the stream identified by the pair
+///(lStream, lSubstream), independently of any numbers which have previously been drawn. Each stream provides
+///2^34 numbers before it wraps.
+///
+///\param lStream The stream to select (the upper half of the counter)
+///\param lSubstream The substream to select (the second word of the counter)
+void rng::SetStream(unsigned long lStream, unsigned long lSubstream)
+{
+    if(type != rng_philox4x32)
+        throw SMC_EXCEPTION(SMCX_UNSUPPORTED_RNG, "Streams can only be selected for counter-based random number generators.");
+
+    philox_state_t* pState = (philox_state_t*) pWorkspace->state;
+    uint64_t lStream64 = lStream;
+
+    pState->ctr[0] = 0;
+    pState->ctr[1] = (uint32_t)lSubstream;
+    pState->ctr[2] = (uint32_t)lStream64;
+    pState->ctr[3] = (uint32_t)(lStream64 >> 32);
+    pState->pos = 4;
+}
+
 ///This function returns a pointer to the underlying GSL random number generator which may be used to provide random
 ///number facilities which are not explicitly provided by the intermediate layer of smc::rng.
 gsl_rng* rng::GetRaw(void)
@@ -252,4 +358,77 @@ double rng::UniformS(void)
 {
     return gsl_rng_uniform(pWorkspace);
 }
+
+///This function draws n uniform[0,1) variates in one call. For the Philox generator they are produced directly from
+///its blocks of output, which avoids an indirect function call per variate; other generators are called in turn.
+void rng::FillUniformS(double* pOut, size_t n)
+{
+    if(type != rng_philox4x32) {
+        for(size_t i = 0; i < n; i++)
+            pOut[i] = gsl_rng_uniform(pWorkspace);
+        return;
+    }
+
+    philox_state_t* pState = (philox_state_t*) pWorkspace->state;
+    size_t i = 0;
+    //Finish any partially consumed block first so that the stream is the same as that of repeated calls to UniformS.
+    while(i < n && pState->pos < 4)
+        pOut[i++] = pState->out[pState->pos++] / 4294967296.0;
+    while(i + 4 <= n) {
+        philox_block(pState);
+        for(int j = 0; j < 4; j++)
+            pOut[i++] = pState->out[j] / 4294967296.0;
+        pState->pos = 4;
+    }
+    if(i < n) {
+        philox_block(pState);
+        while(i < n)
+            pOut[i++] = pState->out[pState->pos++] / 4294967296.0;
+    }
+}
+
+///This function fills an array with exponential variates obtained by inversion of a batch of uniform variates.
+///     \param pOut An array of at least n elements in which to store the variates.
+///     \param n The number of variates to generate.
+///     \param dMean The scale (not rate) (and mean) of the distribution.
+void rng::ExponentialBatch(double* pOut, size_t n, double dMean)
+{
+    FillUniformS(pOut, n);
+
+    #pragma omp simd
+    for(size_t i = 0; i < n; i++)
+        pOut[i] = -dMean * log(1.0 - pOut[i]);
+}
+
+///This function fills an array with normal variates obtained from a batch of uniform variates using the Box-Muller
+///method (see smc::BoxMuller). If n is odd, the final variate is generated by gsl_ran_gaussian.
+///     \param pOut An array of at least n elements in which to store the variates.
+///     \param n The number of variates to generate.
+///     \param dMean The mean of the distribution.
+///     \param dStd  The standard deviation of the distribution
+void rng::NormalBatch(double* pOut, size_t n, double dMean, double dStd)
+{
+    size_t nPairs = n / 2;
+
+    FillUniformS(pOut, 2 * nPairs);
+    BoxMuller(pOut, nPairs, dMean, dStd);
+    if(n % 2)
+        pOut[n - 1] = Normal(dMean, dStd);
+}
+
+///This function fills an array with uniform variates which are scaled and shifted appropriately.
+///     \param pOut An array of at least n elements in which to store the variates.
+///     \param n The number of variates to generate.
+///     \param dMin The lowest value with positive density.
+///     \param dMax The largest value with positive density.
+void rng::UniformBatch(double* pOut, size_t n, double dMin, double dMax)
+{
+    double dScale = dMax - dMin;
+
+    FillUniformS(pOut, n);
+
+    #pragma omp simd
+    for(size_t i = 0; i < n; i++)
+        pOut[i] = dMin + dScale * pOut[i];
+}
 }
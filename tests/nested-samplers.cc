@@ -0,0 +1,111 @@
+//   SMCTC: nested-samplers.cc
+//
+//   This file is part of SMCTC.
+//
+//   SMCTC is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   SMCTC is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with SMCTC.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+//! \file
+//! \brief Runs independent samplers on the threads of a parallel region of the caller.
+//!
+//! Each thread of the outer region runs a sampler of its own, whose moves take their scratch storage from the arenas
+//! of that sampler. The samplers must not interfere with each other, whatever the thread number of the caller, so
+//! each must give the same result as a sampler run on its own.
+
+#include "smctc.hh"
+
+#include <cstdlib>
+
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+
+using namespace std;
+
+///The number of threads in the parallel region of the caller.
+const int nOuter = 4;
+
+smc::particle<double> fInitialise(smc::rng* pRng)
+{
+    std::vector<double, smc::arena_allocator<double> > dScale(16, 1.0);
+    return smc::particle<double>(pRng->NormalS() * dScale[0], 0);
+}
+
+void fMove(long lTime, smc::particle<double> & pFrom, smc::rng* pRng)
+{
+    std::vector<double, smc::arena_allocator<double> > dSteps(256, 0.5);
+    double* x = pFrom.GetValuePointer();
+    *x += pRng->NormalS() * dSteps[lTime % 256];
+    pFrom.AddToLogWeight(-0.005 * *x * *x);
+}
+
+double fValue(const double & x, void*)
+{
+    return x;
+}
+
+///Run a sampler which uses nThreads threads and return the sum of its estimates of the mean.
+double Run(int nThreads)
+{
+    smc::sampler<double> Sampler(1000, SMC_HISTORY_NONE);
+    smc::moveset<double> Moveset(fInitialise, fMove);
+
+    Sampler.SetResampleParams(SMC_RESAMPLE_FRIBBLEBITS, 750);
+    Sampler.SetMoveSet(Moveset);
+    Sampler.SetNumberOfThreads(nThreads);
+    Sampler.Initialise();
+
+    double dSum = 0;
+    for(int n = 0; n < 5; ++n) {
+        Sampler.Iterate();
+        dSum += Sampler.Integrate(fValue, NULL);
+    }
+    return dSum;
+}
+
+int main(int argc, char** argv)
+{
+    try {
+        double dExpected = Run(1);
+        double dResults[nOuter];
+        int nFailures = 0;
+
+        //Most threads of the outer region have thread numbers beyond the number of threads of the samplers they run.
+        //With nested parallelism each sampler forms teams of its own; without, its parallel regions have one thread.
+        for(int nLevels = 1; nLevels <= 2; ++nLevels) {
+#if defined(_OPENMP)
+            omp_set_max_active_levels(nLevels);
+#endif
+            for(int i = 0; i < nOuter; ++i)
+                dResults[i] = 0;
+
+            #pragma omp parallel for num_threads(nOuter)
+            for(int i = 0; i < nOuter; ++i)
+                dResults[i] = Run(nLevels);
+
+            for(int i = 0; i < nOuter; ++i) {
+                if(dResults[i] != dExpected) {
+                    cerr << "Sampler " << i << " with " << nLevels << " levels gave " << dResults[i] << " rather than " << dExpected << endl;
+                    nFailures++;
+                }
+            }
+        }
+        return nFailures ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
+
+    catch(smc::exception  e) {
+        cerr << e;
+        exit(e.lCode);
+    }
+}
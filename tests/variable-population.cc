@@ -0,0 +1,100 @@
+//   SMCTC: variable-population.cc
+//
+//   This file is part of SMCTC.
+//
+//   SMCTC is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   SMCTC is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with SMCTC.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+//! \file
+//! \brief Checks that growing the population in IterateEssVariable does not bias its estimates.
+//!
+//! The starting particles take the values 0, 1/N, ..., (N-1)/N and the move only perturbs the weights, so the mean
+//! of the values after an iteration estimates the mean of the starting values. Rounds which end part way through
+//! the starting particles must not favour any of them, whether the population grows beyond N or is limited below it.
+
+#include "smctc.hh"
+
+#include <cmath>
+#include <cstdlib>
+
+using namespace std;
+
+///The number of particles.
+const long lNumber = 1000;
+///The number of independent runs whose estimates are averaged.
+const int nRuns = 400;
+
+///The number of particles initialised so far, which gives the value of the next one.
+long lInitialised = 0;
+
+smc::particle<double> fInitialise(smc::rng* pRng)
+{
+    return smc::particle<double>(static_cast<double>(lInitialised++ % lNumber) / lNumber, 0);
+}
+
+void fMove(long lTime, smc::particle<double> & pFrom, smc::rng* pRng)
+{
+    pFrom.AddToLogWeight(pRng->NormalS());
+}
+
+double fValue(const double & x, void*)
+{
+    return x;
+}
+
+///Returns the mean, over nRuns runs, of the estimate of the mean value after one iteration.
+double MeanEstimate(long lMaxParticles)
+{
+    double dSum = 0;
+    for(int n = 0; n < nRuns; ++n) {
+        smc::sampler<double> Sampler(lNumber, SMC_HISTORY_NONE, gsl_rng_default, n + 1);
+        smc::moveset<double> Moveset(fInitialise, fMove);
+
+        Sampler.SetResampleParams(SMC_RESAMPLE_STRATIFIED, lNumber);
+        Sampler.SetMaxParticles(lMaxParticles);
+        Sampler.SetMoveSet(Moveset);
+        lInitialised = 0;
+        Sampler.Initialise();
+        Sampler.IterateEssVariable();
+        dSum += Sampler.Integrate(fValue, NULL);
+    }
+    return dSum / nRuns;
+}
+
+int main(int argc, char** argv)
+{
+    //The standard error of the mean estimate is below 0.001 in each case, while taking the starting particles of a
+    //partial round in order biases it by more than 0.03.
+    const double dTrue = 0.5 * (lNumber - 1) / lNumber;
+    const double dTolerance = 0.01;
+    const long lLimits[] = { 100 * lNumber, lNumber * 6 / 10 };
+    int nFailures = 0;
+
+    try {
+        for(int i = 0; i < 2; ++i) {
+            double dMean = MeanEstimate(lLimits[i]);
+            if(std::fabs(dMean - dTrue) > dTolerance) {
+                cerr << "With at most " << lLimits[i] << " particles the mean estimate was " << dMean << " rather than " << dTrue << endl;
+                nFailures++;
+            }
+        }
+    }
+
+    catch(smc::exception  e) {
+        cerr << e;
+        exit(e.lCode);
+    }
+
+    return nFailures ? EXIT_FAILURE : EXIT_SUCCESS;
+}